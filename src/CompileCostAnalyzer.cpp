@@ -0,0 +1,233 @@
+//                        Caide C++ inliner
+//
+// This file is distributed under the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version. See LICENSE.TXT for details.
+
+#include "CompileCostAnalyzer.h"
+#include "clang_version.h"
+#include "DiagnosticsCollector.h"
+#include "FrontendTool.h"
+#include "util.h"
+
+#include <clang/AST/ASTConsumer.h>
+#include <clang/AST/ASTContext.h>
+#include <clang/AST/DeclCXX.h>
+#include <clang/Basic/SourceManager.h>
+#include <clang/Frontend/CompilerInstance.h>
+#include <clang/Frontend/FrontendAction.h>
+#include <clang/Tooling/Tooling.h>
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+using namespace clang;
+using std::string;
+using std::vector;
+
+namespace caide {
+namespace internal {
+
+typedef std::chrono::steady_clock Clock;
+
+struct CompileCosts {
+    // Main file declarations
+    std::map<Decl*, Clock::duration> declCosts;
+    // Everything else, by file name
+    std::map<string, Clock::duration> fileCosts;
+    Clock::duration total = Clock::duration::zero();
+};
+
+// Declaration whose source code produced decl
+static Decl* getPattern(Decl* decl) {
+    if (auto* functionDecl = dyn_cast<FunctionDecl>(decl)) {
+        if (FunctionDecl* pattern = functionDecl->getTemplateInstantiationPattern())
+            return pattern;
+    } else if (auto* recordDecl = dyn_cast<CXXRecordDecl>(decl)) {
+        if (CXXRecordDecl* pattern = recordDecl->getTemplateInstantiationPattern())
+            return pattern;
+    } else if (auto* varDecl = dyn_cast<VarDecl>(decl)) {
+        if (VarDecl* pattern = varDecl->getTemplateInstantiationPattern())
+            return pattern;
+    }
+    return decl;
+}
+
+class CompileCostConsumer: public ASTConsumer {
+public:
+    CompileCostConsumer(SourceManager& sourceManager_, CompileCosts& costs_)
+        : sourceManager(sourceManager_)
+        , costs(costs_)
+        , lastEvent(Clock::now())
+    {}
+
+    // Also called for each instantiated function or static data member definition once it is
+    // complete (mostly at the end of the translation unit), so that the time spent on the
+    // instantiation goes to its template
+    virtual bool HandleTopLevelDecl(DeclGroupRef declGroup) override {
+        Decl* decl = declGroup.isNull() ? nullptr : *declGroup.begin();
+        attributeElapsedTime(decl);
+        return true;
+    }
+
+    virtual void HandleTagDeclDefinition(TagDecl* decl) override {
+        attributeElapsedTime(decl);
+    }
+
+#if CAIDE_CLANG_VERSION_AT_LEAST(3,9)
+    virtual void HandleInlineFunctionDefinition(FunctionDecl* decl) override {
+#else
+    virtual void HandleInlineMethodDefinition(CXXMethodDecl* decl) override {
+#endif
+        attributeElapsedTime(decl);
+    }
+
+    virtual void HandleTranslationUnit(ASTContext&) override {
+        attributeElapsedTime(nullptr);
+    }
+
+private:
+    void attributeElapsedTime(Decl* decl) {
+        Clock::time_point now = Clock::now();
+        Clock::duration elapsed = now - lastEvent;
+        lastEvent = now;
+        costs.total += elapsed;
+
+        if (!decl) {
+            costs.fileCosts["<end of translation unit>"] += elapsed;
+            return;
+        }
+
+        decl = getOutermostDecl(decl);
+        SourceLocation start = getExpansionStart(sourceManager, decl);
+        if (start.isValid() && sourceManager.isInMainFile(start))
+            costs.declCosts[decl->getCanonicalDecl()] += elapsed;
+        else if (start.isValid())
+            costs.fileCosts[sourceManager.getFilename(start).str()] += elapsed;
+        else
+            costs.fileCosts["<unknown>"] += elapsed;
+    }
+
+    Decl* getOutermostDecl(Decl* decl) const {
+        decl = getPattern(decl);
+        for (;;) {
+            DeclContext* parent = decl->getLexicalDeclContext();
+            if (!parent || parent->isFileContext() || isa<LinkageSpecDecl>(parent))
+                return decl;
+            decl = getPattern(cast<Decl>(parent));
+        }
+    }
+
+    SourceManager& sourceManager;
+    CompileCosts& costs;
+    Clock::time_point lastEvent;
+};
+
+class CompileCostFrontendAction : public ASTFrontendAction {
+private:
+    CompileCosts& costs;
+    string& report;
+
+public:
+    CompileCostFrontendAction(CompileCosts& costs_, string& report_)
+        : costs(costs_)
+        , report(report_)
+    {}
+
+    virtual std::unique_ptr<ASTConsumer> CreateASTConsumer(CompilerInstance& compiler, StringRef /*file*/) override
+    {
+        return std::unique_ptr<ASTConsumer>(
+            new CompileCostConsumer(compiler.getSourceManager(), costs));
+    }
+
+    // The report needs source locations, so it is built while the AST is still alive.
+    virtual void EndSourceFileAction() override {
+        report = buildReport(getCompilerInstance().getSourceManager());
+    }
+
+private:
+    string buildReport(SourceManager& sourceManager) const {
+        typedef std::pair<Clock::duration, string> Entry;
+        vector<Entry> entries;
+        for (const auto& kv : costs.declCosts) {
+            string description = kv.first->getDeclKindName();
+            if (const auto* namedDecl = dyn_cast<NamedDecl>(kv.first))
+                description += " " + namedDecl->getQualifiedNameAsString();
+            description += " <" + toString(sourceManager,
+                getExpansionStart(sourceManager, kv.first)) + ">";
+            entries.emplace_back(kv.second, std::move(description));
+        }
+        for (const auto& kv : costs.fileCosts)
+            entries.emplace_back(kv.second, kv.first);
+
+        std::sort(entries.begin(), entries.end(), [](const Entry& lhs, const Entry& rhs) {
+            return lhs.first > rhs.first;
+        });
+
+        auto toMilliseconds = [](Clock::duration d) {
+            return std::chrono::duration_cast<std::chrono::duration<double, std::milli>>(d).count();
+        };
+
+        const double total = toMilliseconds(costs.total);
+        std::ostringstream out;
+        out << std::fixed << std::setprecision(1);
+        out << "Frontend time: " << total << " ms\n";
+        out << "Most expensive declarations (ms, % of total):\n";
+        const size_t maxEntries = 30;
+        for (size_t i = 0; i < entries.size() && i < maxEntries; ++i) {
+            const double ms = toMilliseconds(entries[i].first);
+            out << "  " << std::setw(9) << ms << "  " << std::setw(5)
+                << (total > 0 ? 100.0 * ms / total : 0.0) << "%  " << entries[i].second << "\n";
+        }
+        return out.str();
+    }
+};
+
+class CompileCostFrontendActionFactory: public tooling::FrontendActionFactory {
+private:
+    CompileCosts& costs;
+    string& report;
+
+public:
+    CompileCostFrontendActionFactory(CompileCosts& costs_, string& report_)
+        : costs(costs_)
+        , report(report_)
+    {}
+    FrontendAction* create() {
+        return new CompileCostFrontendAction(costs, report);
+    }
+};
+
+
+CompileCostAnalyzer::CompileCostAnalyzer(const vector<string>& cmdLineOptions_)
+    : cmdLineOptions(cmdLineOptions_)
+{}
+
+string CompileCostAnalyzer::analyze(const string& cppFile) {
+    FrontendTool tool(cmdLineOptions, cppFile);
+
+    DiagnosticsCollector diagnosticsCollector(0);
+    tool.setDiagnosticConsumer(&diagnosticsCollector);
+
+    CompileCosts costs;
+    string report;
+    CompileCostFrontendActionFactory factory(costs, report);
+
+    int ret = tool.run(&factory);
+    if (ret != 0)
+        throw CompilationError(diagnosticsCollector.getDiagnostics());
+
+    return report;
+}
+
+}
+}
+
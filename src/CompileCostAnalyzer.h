@@ -0,0 +1,40 @@
+//                        Caide C++ inliner
+//
+// This file is distributed under the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version. See LICENSE.TXT for details.
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace caide {
+namespace internal {
+
+// Compiles the inliner output and reports which of its declarations take the most
+// time to compile.
+//
+// The frontend (parsing, semantic analysis, template instantiation) is timed between
+// successive ASTConsumer events: completion of a top-level declaration, of a class or of
+// an inline function definition, and of a function template instantiation. Each interval
+// is attributed to the outermost declaration containing the declaration that has just been
+// completed; for instantiations, the declaration of the template they are instantiated from
+// is used. Time spent in system headers is grouped by header.
+//
+// Code generation is not timed.
+class CompileCostAnalyzer {
+public:
+    explicit CompileCostAnalyzer(const std::vector<std::string>& cmdLineOptions);
+
+    // Returns a human-readable report with the most expensive declarations first.
+    // Throws CompilationError if the file doesn't compile.
+    std::string analyze(const std::string& cppFile);
+
+private:
+    std::vector<std::string> cmdLineOptions;
+};
+
+}
+}
+
@@ -6,6 +6,7 @@
 
 #include "DependenciesCollector.h"
 #include "clang_version.h"
+#include "GraphFormat.h"
 #include "SourceInfo.h"
 #include "util.h"
 
@@ -16,10 +17,17 @@
 #include <clang/AST/ASTContext.h>
 #include <clang/AST/RawCommentList.h>
 #include <clang/Basic/SourceManager.h>
+#include <llvm/Support/raw_ostream.h>
 
+#include <algorithm>
+#include <cstdint>
 #include <ostream>
+#include <set>
 #include <sstream>
 #include <string>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
 
 
 using namespace clang;
@@ -28,16 +36,101 @@ using std::set;
 namespace caide {
 namespace internal {
 
+static bool isInDependentContext(Decl* decl) {
+    if (DeclContext* declCtx = dyn_cast<DeclContext>(decl))
+        return declCtx->isDependentContext();
+    DeclContext* declCtx = decl->getDeclContext();
+    return declCtx && declCtx->isDependentContext();
+}
+
+// The template that decl describes, if any
+static Decl* getDescribedTemplate(Decl* decl) {
+    if (CXXRecordDecl* recordDecl = dyn_cast<CXXRecordDecl>(decl))
+        return recordDecl->getDescribedClassTemplate();
+    if (FunctionDecl* functionDecl = dyn_cast<FunctionDecl>(decl))
+        return functionDecl->getDescribedFunctionTemplate();
+    if (VarDecl* varDecl = dyn_cast<VarDecl>(decl))
+        return varDecl->getDescribedVarTemplate();
+    if (TypeAliasDecl* aliasDecl = dyn_cast<TypeAliasDecl>(decl))
+        return aliasDecl->getDescribedAliasTemplate();
+    return nullptr;
+}
+
+// \sa DependenciesCollector::lazy
+static bool isUnit(Decl* decl) {
+    if (isa<TranslationUnitDecl>(decl) || isa<NamespaceDecl>(decl) || isa<LinkageSpecDecl>(decl))
+        return false;
+    // Parameters of alias and variable templates are declared in the enclosing namespace
+    if (isa<TemplateTypeParmDecl>(decl) || isa<NonTypeTemplateParmDecl>(decl) ||
+            isa<TemplateTemplateParmDecl>(decl))
+        return false;
+    // The templated declaration is a part of the template
+    if (getDescribedTemplate(decl))
+        return false;
+    DeclContext* declCtx = decl->getLexicalDeclContext();
+    return declCtx && declCtx->getRedeclContext()->isFileContext();
+}
+
+static Decl* getUnit(Decl* decl) {
+    while (decl) {
+        if (Decl* describedTemplate = getDescribedTemplate(decl))
+            decl = describedTemplate;
+        if (isUnit(decl))
+            return decl;
+        decl = dyn_cast_or_null<Decl>(decl->getLexicalDeclContext());
+    }
+    return nullptr;
+}
+
 bool DependenciesCollector::TraverseDecl(Decl* decl) {
-    declStack.push(decl);
+    // Other units are traversed when they are needed
+    if (lazy && decl && decl != currentUnit && isUnit(decl))
+        return true;
+
+    ActiveDecl activeDecl;
+    activeDecl.decl = decl;
+    activeDecl.pattern = nullptr;
+    activeDecl.isPattern = false;
+    if (decl && sourceManager.isInMainFile(decl->getLocStart())) {
+        if (isInDependentContext(decl))
+            activeDecl.isPattern = true;
+        else
+            activeDecl.pattern = getInstantiationPattern(decl);
+    }
+    // Statements shared with the pattern are recognized only if it has been traversed
+    if (lazy && activeDecl.pattern)
+        collectDependenciesOf(activeDecl.pattern);
+
+    declStack.push(activeDecl);
     bool ret = RecursiveASTVisitor<DependenciesCollector>::TraverseDecl(decl);
     declStack.pop();
     return ret;
 }
 
+// Template instantiation doesn't rebuild expressions that are not affected by template arguments:
+// the instantiated body shares them with the template. The dependencies of such an expression
+// have already been collected from the template, and an instantiation depends on the template,
+// so it is enough to traverse the parts of the instantiation that depend on template arguments
+// (types, calls resolved by argument-dependent lookup, chosen specializations etc.)
+bool DependenciesCollector::TraverseStmt(Stmt* stmt) {
+    if (stmt && !declStack.empty()) {
+        const ActiveDecl& activeDecl = declStack.top();
+        if (activeDecl.isPattern) {
+            patternStmts.emplace(stmt, activeDecl.decl->getCanonicalDecl());
+        } else if (activeDecl.pattern) {
+            auto it = patternStmts.find(stmt);
+            if (it != patternStmts.end() && it->second == activeDecl.pattern->getCanonicalDecl()) {
+                insertReference(activeDecl.decl, activeDecl.pattern, DependencyKind::Template);
+                return true;
+            }
+        }
+    }
+    return RecursiveASTVisitor<DependenciesCollector>::TraverseStmt(stmt);
+}
+
 
 Decl* DependenciesCollector::getCurrentDecl() const {
-    return declStack.empty() ? nullptr : declStack.top();
+    return declStack.empty() ? nullptr : declStack.top().decl;
 }
 
 FunctionDecl* DependenciesCollector::getCurrentFunction(Decl* decl) const {
@@ -68,7 +161,16 @@ Decl* DependenciesCollector::getCorrespondingDeclInNonInstantiatedContext(clang:
     return nullptr;
 }
 
-void DependenciesCollector::insertReference(Decl* from, Decl* to) {
+// Returns the Decl that an implicitly instantiated Decl was instantiated from.
+Decl* DependenciesCollector::getInstantiationPattern(Decl* decl) const {
+    Decl* pattern = getCorrespondingDeclInNonInstantiatedContext(decl);
+    // Different Decls may share a location, e.g. if they come from the same macro expansion
+    if (!pattern || pattern == decl || !isInDependentContext(pattern))
+        return nullptr;
+    return pattern;
+}
+
+void DependenciesCollector::insertReference(Decl* from, Decl* to, DependencyKind kind) {
     if (!from || !to)
         return;
     from = from->getCanonicalDecl();
@@ -76,6 +178,8 @@ void DependenciesCollector::insertReference(Decl* from, Decl* to) {
     if (from == to)
         return;
     srcInfo.uses[from].insert(to);
+    if (srcInfo.recordDependencyKinds)
+        srcInfo.dependencyKinds.emplace(std::make_pair(from, to), kind);
     dbg("Reference   FROM    " << from->getDeclKindName() << " " << from
         << "<" << toString(sourceManager, from).substr(0, 20) << ">"
         << toString(sourceManager, from->getSourceRange())
@@ -109,7 +213,7 @@ void DependenciesCollector::insertReferenceToType(Decl* from, const Type* to,
     if (const ParenType* parenType = dyn_cast<ParenType>(to))
         insertReferenceToType(from, parenType->getInnerType(), seen);
 
-    insertReference(from, to->getAsTagDecl());
+    insertReference(from, to->getAsTagDecl(), DependencyKind::Type);
 
     if (const ArrayType* arrayType = dyn_cast<ArrayType>(to))
         insertReferenceToType(from, arrayType->getElementType(), seen);
@@ -123,7 +227,7 @@ void DependenciesCollector::insertReferenceToType(Decl* from, const Type* to,
     }
 
     if (const TypedefType* typedefType = dyn_cast<TypedefType>(to))
-        insertReference(from, typedefType->getDecl());
+        insertReference(from, typedefType->getDecl(), DependencyKind::Type);
 
     if (const TemplateSpecializationType* tempSpecType =
             dyn_cast<TemplateSpecializationType>(to))
@@ -131,7 +235,7 @@ void DependenciesCollector::insertReferenceToType(Decl* from, const Type* to,
         if (tempSpecType->isTypeAlias())
             insertReferenceToType(from, tempSpecType->getAliasedType());
         if (TemplateDecl* tempDecl = tempSpecType->getTemplateName().getAsTemplateDecl())
-            insertReference(from, tempDecl);
+            insertReference(from, tempDecl, DependencyKind::Type);
         for (unsigned i = 0; i < tempSpecType->getNumArgs(); ++i) {
             const TemplateArgument& arg = tempSpecType->getArg(i);
             if (arg.getKind() == TemplateArgument::Type)
@@ -166,9 +270,73 @@ void DependenciesCollector::insertReferenceToType(Decl* from, const TypeSourceIn
 DependenciesCollector::DependenciesCollector(SourceManager& srcMgr, SourceInfo& srcInfo_)
     : sourceManager(srcMgr)
     , srcInfo(srcInfo_)
+    , lazy(false)
+    , currentUnit(nullptr)
 {
 }
 
+void DependenciesCollector::findMainFileRoots(TranslationUnitDecl* translationUnit) {
+    lazy = true;
+    findRoots(translationUnit);
+}
+
+// Only declarations are visited, not function bodies or template instantiations
+void DependenciesCollector::findRoots(DeclContext* declCtx) {
+    for (Decl* decl : declCtx->decls()) {
+        if (!sourceManager.isInMainFile(decl->getLocStart())) {
+            if (isa<NamespaceDecl>(decl) || isa<LinkageSpecDecl>(decl))
+                findRoots(cast<DeclContext>(decl));
+            continue;
+        }
+
+        if (TemplateDecl* templateDecl = dyn_cast<TemplateDecl>(decl)) {
+            checkComments(templateDecl);
+            decl = templateDecl->getTemplatedDecl();
+            if (!decl)
+                continue;
+        }
+        checkComments(decl);
+
+        if (FunctionDecl* f = dyn_cast<FunctionDecl>(decl)) {
+            if (f->isMain())
+                srcInfo.declsToKeep.insert(f);
+            if (f->isLateTemplateParsed())
+                srcInfo.delayedParsedFunctions.push_back(f);
+        } else if (ClassTemplateSpecializationDecl* specDecl =
+                       dyn_cast<ClassTemplateSpecializationDecl>(decl)) {
+            if (specDecl->getSpecializationKind() != TSK_ImplicitInstantiation)
+                findRoots(specDecl);
+        } else if (isa<CXXRecordDecl>(decl) || isa<NamespaceDecl>(decl) ||
+                   isa<LinkageSpecDecl>(decl)) {
+            findRoots(cast<DeclContext>(decl));
+        }
+    }
+}
+
+void DependenciesCollector::collectDependenciesOf(Decl* decl) {
+    // Edges from a declaration are inserted while traversing any of its redeclarations
+    // (e.g. the body of a method defined outside of its class)
+    for (Decl* redecl : decl->redecls()) {
+        Decl* unit = getUnit(redecl);
+        if (!unit || !traversedUnits.insert(unit).second)
+            continue;
+        // Called recursively for the pattern of an instantiation
+        Decl* enclosingUnit = currentUnit;
+        currentUnit = unit;
+        TraverseDecl(unit);
+        currentUnit = enclosingUnit;
+    }
+}
+
+std::size_t DependenciesCollector::getNumTraversedMainFileUnits() const {
+    std::size_t count = 0;
+    for (Decl* unit : traversedUnits) {
+        if (sourceManager.isInMainFile(unit->getLocStart()))
+            ++count;
+    }
+    return count;
+}
+
 bool DependenciesCollector::shouldVisitImplicitCode() const { return true; }
 bool DependenciesCollector::shouldVisitTemplateInstantiations() const { return true; }
 bool DependenciesCollector::shouldWalkTypesOfTypeLocs() const { return true; }
@@ -182,28 +350,37 @@ bool DependenciesCollector::VisitDecl(Decl* decl) {
     // Mark dependence on enclosing (semantic) class/namespace.
     Decl* ctx = dyn_cast_or_null<Decl>(decl->getDeclContext());
     if (ctx && !isa<FunctionDecl>(ctx))
-        insertReference(decl, ctx);
+        insertReference(decl, ctx, DependencyKind::Context);
 
     if (!sourceManager.isInMainFile(decl->getLocStart()))
         return true;
 
     // If this declaration is inside a template instantiation, mark dependence on the corresponding
     // declaration in a non-instantiated context.
-    insertReference(decl, getCorrespondingDeclInNonInstantiatedContext(decl));
+    insertReference(decl, getCorrespondingDeclInNonInstantiatedContext(decl), DependencyKind::Template);
+
+    // In lazy mode, the comments are checked by findMainFileRoots()
+    if (!lazy)
+        checkComments(decl);
+    return true;
+}
 
+// 'caide keep' and 'caide concept' comments
+void DependenciesCollector::checkComments(Decl* decl) {
+    Decl* ctx = dyn_cast_or_null<Decl>(decl->getDeclContext());
     RawComment* comment = decl->getASTContext().getRawCommentForDeclNoCache(decl);
     if (!comment)
-        return true;
+        return;
 
     bool invalid = false;
     const char* beg = sourceManager.getCharacterData(comment->getLocStart(), &invalid);
     if (!beg || invalid)
-        return true;
+        return;
 
     const char* end =
         sourceManager.getCharacterData(comment->getLocEnd(), &invalid);
     if (!end || invalid)
-        return true;
+        return;
 
     StringRef haystack(beg, end - beg + 1);
 
@@ -234,10 +411,8 @@ bool DependenciesCollector::VisitDecl(Decl* decl) {
         StringRef needle(caideConceptComment);
         dbg(toString(sourceManager, decl) << ": " << haystack.str() << std::endl);
         if (haystack.find(needle) != StringRef::npos)
-            insertReference(ctx, decl);
+            insertReference(ctx, decl, DependencyKind::Concept);
     }
-
-    return true;
 }
 
 bool DependenciesCollector::VisitCallExpr(CallExpr* callExpr) {
@@ -248,13 +423,13 @@ bool DependenciesCollector::VisitCallExpr(CallExpr* callExpr) {
     if (!callee || !calleeDecl || isa<UnresolvedMemberExpr>(callee) || isa<CXXDependentScopeMemberExpr>(callee))
         return true;
 
-    insertReference(getCurrentDecl(), calleeDecl);
+    insertReference(getCurrentDecl(), calleeDecl, DependencyKind::Call);
     return true;
 }
 
 bool DependenciesCollector::VisitCXXConstructExpr(CXXConstructExpr* constructorExpr) {
     dbg(CAIDE_FUNC);
-    insertReference(getCurrentDecl(), constructorExpr->getConstructor());
+    insertReference(getCurrentDecl(), constructorExpr->getConstructor(), DependencyKind::Call);
     return true;
 }
 
@@ -264,11 +439,11 @@ bool DependenciesCollector::VisitCXXConstructorDecl(CXXConstructorDecl* ctorDecl
 #else
     auto* inheritedCtor = const_cast<CXXConstructorDecl*>(ctorDecl->getInheritedConstructor());
 #endif
-    insertReference(ctorDecl, inheritedCtor);
+    insertReference(ctorDecl, inheritedCtor, DependencyKind::Call);
     for (auto it = ctorDecl->init_begin(); it != ctorDecl->init_end(); ++it) {
         CXXCtorInitializer* ctorInit = *it;
         if (ctorInit->isWritten())
-            insertReference(getCurrentDecl(), ctorInit->getMember());
+            insertReference(getCurrentDecl(), ctorInit->getMember(), DependencyKind::Reference);
         insertReferenceToType(getCurrentDecl(), ctorInit->getBaseClass());
         insertReferenceToType(getCurrentDecl(), ctorInit->getTypeSourceInfo());
     }
@@ -302,7 +477,7 @@ void DependenciesCollector::insertReference(Decl* from, NestedNameSpecifier* spe
 bool DependenciesCollector::VisitDeclRefExpr(DeclRefExpr* ref) {
     dbg(CAIDE_FUNC);
     Decl* currentDecl = getCurrentDecl();
-    insertReference(currentDecl, ref->getFoundDecl());
+    insertReference(currentDecl, ref->getFoundDecl(), DependencyKind::Reference);
     insertReference(currentDecl, ref->getQualifier());
     return true;
 }
@@ -321,7 +496,7 @@ bool DependenciesCollector::VisitValueDecl(ValueDecl* valueDecl) {
     dbg(CAIDE_FUNC);
     // Mark any function as depending on its local variables.
     // TODO: detect unused local variables.
-    insertReference(getCurrentFunction(valueDecl), valueDecl);
+    insertReference(getCurrentFunction(valueDecl), valueDecl, DependencyKind::Member);
 
     insertReferenceToType(valueDecl, valueDecl->getType());
     return true;
@@ -332,14 +507,14 @@ bool DependenciesCollector::VisitMemberExpr(MemberExpr* memberExpr) {
     dbg(CAIDE_FUNC);
     Decl* currentDecl = getCurrentDecl();
     // getFoundDecl() returns either MemberDecl itself or UsingShadowDecl corresponding to a UsingDecl
-    insertReference(currentDecl, memberExpr->getFoundDecl().getDecl());
+    insertReference(currentDecl, memberExpr->getFoundDecl().getDecl(), DependencyKind::Reference);
     insertReference(currentDecl, memberExpr->getQualifier());
     return true;
 }
 
 bool DependenciesCollector::VisitUsingShadowDecl(UsingShadowDecl* usingShadowDecl) {
-    insertReference(usingShadowDecl, usingShadowDecl->getUsingDecl());
-    insertReference(usingShadowDecl, usingShadowDecl->getTargetDecl());
+    insertReference(usingShadowDecl, usingShadowDecl->getUsingDecl(), DependencyKind::Reference);
+    insertReference(usingShadowDecl, usingShadowDecl->getTargetDecl(), DependencyKind::Reference);
     return true;
 }
 
@@ -351,13 +526,13 @@ bool DependenciesCollector::VisitUsingDecl(UsingDecl* usingDecl) {
 
 bool DependenciesCollector::VisitLambdaExpr(LambdaExpr* lambdaExpr) {
     dbg(CAIDE_FUNC);
-    insertReference(getCurrentDecl(), lambdaExpr->getCallOperator());
+    insertReference(getCurrentDecl(), lambdaExpr->getCallOperator(), DependencyKind::Reference);
     return true;
 }
 
 bool DependenciesCollector::VisitFieldDecl(FieldDecl* field) {
     dbg(CAIDE_FUNC);
-    insertReference(field, field->getParent());
+    insertReference(field, field->getParent(), DependencyKind::Context);
     return true;
 }
 
@@ -370,19 +545,19 @@ bool DependenciesCollector::VisitTypedefNameDecl(TypedefNameDecl* typedefDecl) {
 
 bool DependenciesCollector::VisitTypeAliasDecl(TypeAliasDecl* aliasDecl) {
     dbg(CAIDE_FUNC);
-    insertReference(aliasDecl, aliasDecl->getDescribedAliasTemplate());
+    insertReference(aliasDecl, aliasDecl->getDescribedAliasTemplate(), DependencyKind::Template);
     return true;
 }
 
 bool DependenciesCollector::VisitTypeAliasTemplateDecl(TypeAliasTemplateDecl* aliasTemplateDecl) {
     dbg(CAIDE_FUNC);
-    insertReference(aliasTemplateDecl, aliasTemplateDecl->getInstantiatedFromMemberTemplate());
+    insertReference(aliasTemplateDecl, aliasTemplateDecl->getInstantiatedFromMemberTemplate(), DependencyKind::Template);
     return true;
 }
 
 bool DependenciesCollector::VisitClassTemplateDecl(ClassTemplateDecl* templateDecl) {
     dbg(CAIDE_FUNC);
-    insertReference(templateDecl, templateDecl->getTemplatedDecl());
+    insertReference(templateDecl, templateDecl->getTemplatedDecl(), DependencyKind::Template);
     return true;
 }
 
@@ -396,9 +571,9 @@ bool DependenciesCollector::VisitClassTemplateSpecializationDecl(ClassTemplateSp
         instantiatedFrom = specDecl->getSpecializedTemplateOrPartial();
 
     if (instantiatedFrom.is<ClassTemplateDecl*>())
-        insertReference(specDecl, instantiatedFrom.get<ClassTemplateDecl*>());
+        insertReference(specDecl, instantiatedFrom.get<ClassTemplateDecl*>(), DependencyKind::Template);
     else if (instantiatedFrom.is<ClassTemplatePartialSpecializationDecl*>())
-        insertReference(specDecl, instantiatedFrom.get<ClassTemplatePartialSpecializationDecl*>());
+        insertReference(specDecl, instantiatedFrom.get<ClassTemplatePartialSpecializationDecl*>(), DependencyKind::Template);
 
     return true;
 }
@@ -419,7 +594,7 @@ bool DependenciesCollector::VisitFunctionDecl(FunctionDecl* f) {
     if (f->isMain())
         srcInfo.declsToKeep.insert(f);
 
-    if (sourceManager.isInMainFile(f->getLocStart()) && f->isLateTemplateParsed())
+    if (!lazy && sourceManager.isInMainFile(f->getLocStart()) && f->isLateTemplateParsed())
         srcInfo.delayedParsedFunctions.push_back(f);
 
     if (f->getTemplatedKind() == FunctionDecl::TK_FunctionTemplate) {
@@ -429,7 +604,7 @@ bool DependenciesCollector::VisitFunctionDecl(FunctionDecl* f) {
 
     FunctionTemplateSpecializationInfo* specInfo = f->getTemplateSpecializationInfo();
     if (specInfo) {
-        insertReference(f, specInfo->getTemplate()->getTemplatedDecl());
+        insertReference(f, specInfo->getTemplate()->getTemplatedDecl(), DependencyKind::Template);
         // Add references to template argument types as they are written in code, not the canonical types.
         if (const ASTTemplateArgumentListInfo* templateArgs = specInfo->TemplateArgumentsAsWritten) {
             for (unsigned i = 0; i < templateArgs->NumTemplateArgs; ++i) {
@@ -442,7 +617,7 @@ bool DependenciesCollector::VisitFunctionDecl(FunctionDecl* f) {
 
     insertReferenceToType(f, f->getReturnType());
 
-    insertReference(f, f->getInstantiatedFromMemberFunction());
+    insertReference(f, f->getInstantiatedFromMemberFunction(), DependencyKind::Template);
 
     if (f->doesThisDeclarationHaveABody() &&
             sourceManager.isInMainFile(f->getLocStart()))
@@ -460,27 +635,27 @@ bool DependenciesCollector::VisitFunctionDecl(FunctionDecl* f) {
 
 bool DependenciesCollector::VisitFunctionTemplateDecl(FunctionTemplateDecl* functionTemplate) {
     insertReference(functionTemplate,
-            functionTemplate->getInstantiatedFromMemberTemplate());
+            functionTemplate->getInstantiatedFromMemberTemplate(), DependencyKind::Template);
     return true;
 }
 
 bool DependenciesCollector::VisitCXXMethodDecl(CXXMethodDecl* method) {
     dbg(CAIDE_FUNC);
-    insertReference(method, method->getParent());
+    insertReference(method, method->getParent(), DependencyKind::Context);
     if (method->isVirtual()) {
         // Virtual methods may not be called directly. Assume that
         // if we need a class, we need all its virtual methods.
         // TODO: a more detailed analysis (walk the inheritance tree?)
-        insertReference(method->getParent(), method);
+        insertReference(method->getParent(), method, DependencyKind::Member);
     }
     return true;
 }
 
 bool DependenciesCollector::VisitCXXRecordDecl(CXXRecordDecl* recordDecl) {
-    insertReference(recordDecl, recordDecl->getDescribedClassTemplate());
+    insertReference(recordDecl, recordDecl->getDescribedClassTemplate(), DependencyKind::Template);
     // No implicit calls to destructors in AST; assume that
     // if a class is used, its destructor is used too.
-    insertReference(recordDecl, recordDecl->getDestructor());
+    insertReference(recordDecl, recordDecl->getDestructor(), DependencyKind::Member);
 
     if (recordDecl->isThisDeclarationADefinition()) {
         for (const CXXBaseSpecifier* base = recordDecl->bases_begin();
@@ -505,8 +680,8 @@ bool DependenciesCollector::VisitEnumDecl(EnumDecl* enumDecl) {
     // So we assume that either the whole enum is used or it is unused. For this purpose, insert
     // bidirectional dependency links connecting the enum and each enum constant.
     for (auto it = enumDecl->enumerator_begin(); it != enumDecl->enumerator_end(); ++it) {
-        insertReference(enumDecl, *it);
-        insertReference(*it, enumDecl);
+        insertReference(enumDecl, *it, DependencyKind::Member);
+        insertReference(*it, enumDecl, DependencyKind::Member);
     }
 
     // reference to underlying type
@@ -554,6 +729,196 @@ void DependenciesCollector::printGraph(std::ostream& out) const {
     out << "}\n";
 }
 
+namespace {
+
+class StringTable {
+public:
+    StringTable() {
+        add("");
+    }
+
+    std::uint32_t add(const std::string& s) {
+        auto it = indices.find(s);
+        if (it != indices.end())
+            return it->second;
+        std::uint32_t index = static_cast<std::uint32_t>(offsets.size());
+        indices.emplace(s, index);
+        offsets.push_back(data.size());
+        data += s;
+        return index;
+    }
+
+    const std::string& getData() const { return data; }
+    // Offsets of all strings, followed by the total length
+    std::vector<std::uint64_t> getOffsets() const {
+        std::vector<std::uint64_t> res(offsets);
+        res.push_back(data.size());
+        return res;
+    }
+
+private:
+    std::unordered_map<std::string, std::uint32_t> indices;
+    std::vector<std::uint64_t> offsets;
+    std::string data;
+};
+
+std::uint64_t alignTo8(std::uint64_t offset) {
+    return (offset + 7) / 8 * 8;
+}
+
+void writePadding(std::ostream& out, std::uint64_t from, std::uint64_t to) {
+    static const char zeros[8] = {};
+    out.write(zeros, to - from);
+}
+
+template<typename T>
+void writeValue(std::ostream& out, const T& value) {
+    out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template<typename T>
+void writeArray(std::ostream& out, const std::vector<T>& array) {
+    out.write(reinterpret_cast<const char*>(array.data()), array.size() * sizeof(T));
+}
+
+}
+
+void DependenciesCollector::writeBinaryGraph(std::ostream& out) const {
+    const auto& graph = srcInfo.uses;
+
+    std::unordered_map<const Decl*, std::uint32_t> nodeIds;
+    std::vector<const Decl*> decls;
+    auto addNode = [&](const Decl* decl) {
+        if (decl && nodeIds.emplace(decl, static_cast<std::uint32_t>(decls.size())).second)
+            decls.push_back(decl);
+    };
+    std::set<const Decl*> roots;
+    for (Decl* decl : srcInfo.declsToKeep) {
+        roots.insert(decl->getCanonicalDecl());
+        addNode(decl->getCanonicalDecl());
+    }
+    for (const auto& it : graph) {
+        addNode(it.first);
+        for (const Decl* to : it.second)
+            addNode(to);
+    }
+
+    // Number the nodes in source order rather than in pointer order, so that the same input
+    // always produces the same file. Specializations at the same location are told apart
+    // by their template arguments.
+    struct NodeKey {
+        std::string file;
+        unsigned begin;
+        unsigned end;
+        std::string kind;
+        std::string name;
+    };
+    std::unordered_map<const Decl*, NodeKey> keys;
+    for (const Decl* decl : decls) {
+        NodeKey& key = keys[decl];
+        SourceLocation begin = sourceManager.getExpansionLoc(decl->getLocStart());
+        SourceLocation end = sourceManager.getExpansionLoc(decl->getLocEnd());
+        key.file = sourceManager.getFilename(begin).str();
+        key.begin = sourceManager.getFileOffset(begin);
+        key.end = sourceManager.getFileOffset(end);
+        key.kind = decl->getDeclKindName();
+        if (const auto* namedDecl = dyn_cast<NamedDecl>(decl)) {
+            llvm::raw_string_ostream name(key.name);
+            namedDecl->getNameForDiagnostic(name, decl->getASTContext().getPrintingPolicy(),
+                                            /*Qualified=*/true);
+        }
+    }
+    std::stable_sort(decls.begin(), decls.end(), [&](const Decl* lhs, const Decl* rhs) {
+        const NodeKey& l = keys[lhs];
+        const NodeKey& r = keys[rhs];
+        return std::tie(l.file, l.begin, l.end, l.kind, l.name) <
+               std::tie(r.file, r.begin, r.end, r.kind, r.name);
+    });
+    for (std::size_t i = 0; i < decls.size(); ++i)
+        nodeIds[decls[i]] = static_cast<std::uint32_t>(i);
+
+    auto outEdges = [&](const Decl* decl) -> const std::set<Decl*>* {
+        auto it = graph.find(const_cast<Decl*>(decl));
+        return it == graph.end() ? nullptr : &it->second;
+    };
+    std::uint64_t numEdges = 0;
+    for (const Decl* decl : decls) {
+        if (const auto* edges = outEdges(decl))
+            numEdges += edges->size() - edges->count(nullptr);
+    }
+
+    // Sections are written as they are computed. Only the string table, which is written last,
+    // is kept in memory; the header is rewritten once its size is known.
+    GraphFileHeader header;
+    std::copy(graphFileMagic, graphFileMagic + sizeof(graphFileMagic), header.magic);
+    header.numStrings = 0;
+    header.numNodes = decls.size();
+    header.numEdges = numEdges;
+    header.nodesOffset = sizeof(GraphFileHeader);
+    header.edgeOffsetsOffset = header.nodesOffset + decls.size() * sizeof(GraphNode);
+    header.edgeTargetsOffset = header.edgeOffsetsOffset + (decls.size() + 1) * sizeof(std::uint64_t);
+    header.stringOffsetsOffset = alignTo8(header.edgeTargetsOffset + numEdges * sizeof(std::uint32_t));
+    header.stringDataOffset = header.stringOffsetsOffset;
+    const std::streampos start = out.tellp();
+    writeValue(out, header);
+
+    StringTable strings;
+    for (const Decl* decl : decls) {
+        GraphNode node;
+        if (const auto* namedDecl = dyn_cast<NamedDecl>(decl))
+            node.name = strings.add(namedDecl->getQualifiedNameAsString());
+        else
+            node.name = 0;
+        node.kind = strings.add(decl->getDeclKindName());
+
+        SourceLocation begin = sourceManager.getExpansionLoc(decl->getLocStart());
+        SourceLocation end = sourceManager.getExpansionLoc(decl->getLocEnd());
+        node.file = strings.add(sourceManager.getFilename(begin).str());
+        node.flags = 0;
+        if (roots.count(decl))
+            node.flags |= GraphNodeIsRoot;
+        if (sourceManager.isInMainFile(begin))
+            node.flags |= GraphNodeIsInMainFile;
+        node.beginLine = sourceManager.getExpansionLineNumber(begin);
+        node.beginColumn = sourceManager.getExpansionColumnNumber(begin);
+        node.endLine = sourceManager.getExpansionLineNumber(end);
+        node.endColumn = sourceManager.getExpansionColumnNumber(end);
+        writeValue(out, node);
+    }
+
+    std::uint64_t edgeOffset = 0;
+    writeValue(out, edgeOffset);
+    for (const Decl* decl : decls) {
+        if (const auto* edges = outEdges(decl))
+            edgeOffset += edges->size() - edges->count(nullptr);
+        writeValue(out, edgeOffset);
+    }
+
+    std::vector<std::uint32_t> targets;
+    for (const Decl* decl : decls) {
+        if (const auto* edges = outEdges(decl)) {
+            targets.clear();
+            for (const Decl* to : *edges) if (to)
+                targets.push_back(nodeIds.find(to)->second);
+            std::sort(targets.begin(), targets.end());
+            writeArray(out, targets);
+        }
+    }
+    writePadding(out, header.edgeTargetsOffset + numEdges * sizeof(std::uint32_t),
+                 header.stringOffsetsOffset);
+
+    const std::vector<std::uint64_t> stringOffsets = strings.getOffsets();
+    const std::string& stringData = strings.getData();
+    writeArray(out, stringOffsets);
+    out.write(stringData.data(), stringData.size());
+
+    header.numStrings = stringOffsets.size() - 1;
+    header.stringDataOffset = header.stringOffsetsOffset + stringOffsets.size() * sizeof(std::uint64_t);
+    out.seekp(start);
+    writeValue(out, header);
+    out.seekp(0, std::ios::end);
+}
+
 
 }
 }
@@ -15,10 +15,13 @@
 #include <set>
 #include <stack>
 #include <map>
+#include <unordered_map>
+#include <unordered_set>
 
 
 namespace clang {
     class SourceManager;
+    class TranslationUnitDecl;
 }
 
 
@@ -26,6 +29,7 @@ namespace caide {
 namespace internal {
 
 class SourceInfo;
+enum class DependencyKind;
 
 
 class DependenciesCollector: public clang::RecursiveASTVisitor<DependenciesCollector> {
@@ -37,6 +41,7 @@ public:
     bool shouldWalkTypesOfTypeLocs() const;
 
     bool TraverseDecl(clang::Decl* decl);
+    bool TraverseStmt(clang::Stmt* stmt);
 
     bool VisitStmt(clang::Stmt* stmt);
 
@@ -68,16 +73,37 @@ public:
     bool VisitUsingShadowDecl(clang::UsingShadowDecl* usingDecl);
     bool VisitEnumDecl(clang::EnumDecl* enumDecl);
 
+    // Lazy mode: find the roots of the graph (main function, 'caide keep' declarations) and
+    // delayed parsed functions in the main file, and 'caide concept' edges, without traversing
+    // function bodies. Dependencies are collected by collectDependenciesOf() when they are
+    // needed, so that unused code (and its instantiations) is not traversed at all.
+    void findMainFileRoots(clang::TranslationUnitDecl* translationUnit);
+
+    // Lazy mode: make sure that srcInfo.uses contains all dependencies of the declaration.
+    void collectDependenciesOf(clang::Decl* decl);
+
+    // Lazy mode: the number of units in the main file traversed so far
+    std::size_t getNumTraversedMainFileUnits() const;
+
+    // Print the graph in DOT format. Useful for debugging small inputs only.
     void printGraph(std::ostream& out) const;
 
+    // Stream the graph in the binary format described in GraphFormat.h. The stream must be
+    // seekable (the header is written last). Errors are reported in the state of the stream.
+    void writeBinaryGraph(std::ostream& out) const;
+
 private:
     clang::Decl* getCurrentDecl() const;
     clang::FunctionDecl* getCurrentFunction(clang::Decl* decl) const;
     clang::Decl* getParentDecl(clang::Decl* decl) const;
 
     clang::Decl* getCorrespondingDeclInNonInstantiatedContext(clang::Decl* semanticDecl) const;
+    clang::Decl* getInstantiationPattern(clang::Decl* decl) const;
+
+    void findRoots(clang::DeclContext* declCtx);
+    void checkComments(clang::Decl* decl);
 
-    void insertReference(clang::Decl* from, clang::Decl* to);
+    void insertReference(clang::Decl* from, clang::Decl* to, DependencyKind kind);
     void insertReferenceToType(clang::Decl* from, const clang::Type* to, std::set<const clang::Type*>& seen);
     void insertReferenceToType(clang::Decl* from, clang::QualType to, std::set<const clang::Type*>& seen);
     void insertReferenceToType(clang::Decl* from, clang::QualType to);
@@ -89,10 +115,31 @@ private:
     clang::SourceManager& sourceManager;
     SourceInfo& srcInfo;
 
+    struct ActiveDecl {
+        clang::Decl* decl;
+        // The corresponding Decl in the template if decl comes from an implicit instantiation
+        clang::Decl* pattern;
+        // decl is a part of a template in the main file
+        bool isPattern;
+    };
+
     // There is no getParentDecl(stmt) function, so we maintain the stack of Decls,
     // with inner-most active Decl at the top of the stack.
     // \sa TraverseDecl().
-    std::stack<clang::Decl*> declStack;
+    std::stack<ActiveDecl> declStack;
+
+    // key: Stmt in a template in the main file, value: canonical Decl whose dependencies
+    // include those of the Stmt.
+    // \sa TraverseStmt().
+    std::unordered_map<clang::Stmt*, clang::Decl*> patternStmts;
+
+    // In lazy mode, declarations are traversed in units: a unit is a declaration at namespace
+    // scope together with everything lexically inside it, except nested units.
+    // \sa collectDependenciesOf().
+    bool lazy;
+    // The unit that is being traversed on demand
+    clang::Decl* currentUnit;
+    std::unordered_set<clang::Decl*> traversedUnits;
 };
 
 }
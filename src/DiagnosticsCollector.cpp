@@ -0,0 +1,84 @@
+//                        Caide C++ inliner
+//
+// This file is distributed under the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version. See LICENSE.TXT for details.
+
+#include "DiagnosticsCollector.h"
+
+#include <clang/Basic/SourceManager.h>
+#include <llvm/ADT/SmallString.h>
+
+
+using namespace clang;
+
+namespace caide {
+namespace internal {
+
+DiagnosticsCollector::DiagnosticsCollector(int errorLimit_)
+    : errorLimit(errorLimit_)
+    , fatalErrorOccurred(false)
+{}
+
+void DiagnosticsCollector::HandleDiagnostic(DiagnosticsEngine::Level level, const Diagnostic& info) {
+    // Updates error and warning counts
+    DiagnosticConsumer::HandleDiagnostic(level, info);
+
+    CompilationDiagnostic diagnostic;
+    switch (level) {
+        case DiagnosticsEngine::Note:
+            diagnostic.severity = CompilationDiagnostic::Severity::Note;
+            break;
+        case DiagnosticsEngine::Warning:
+            diagnostic.severity = CompilationDiagnostic::Severity::Warning;
+            break;
+        case DiagnosticsEngine::Error:
+            diagnostic.severity = CompilationDiagnostic::Severity::Error;
+            break;
+        case DiagnosticsEngine::Fatal:
+            diagnostic.severity = CompilationDiagnostic::Severity::Fatal;
+            fatalErrorOccurred = true;
+            break;
+        default:
+            return;
+    }
+
+    llvm::SmallString<256> message;
+    info.FormatDiagnostic(message);
+    diagnostic.message = message.str();
+
+    diagnostic.line = diagnostic.column = 0;
+    if (info.getLocation().isValid() && info.hasSourceManager()) {
+        PresumedLoc presumedLoc = info.getSourceManager().getPresumedLoc(info.getLocation());
+        if (presumedLoc.isValid()) {
+            diagnostic.file = presumedLoc.getFilename();
+            diagnostic.line = presumedLoc.getLine();
+            diagnostic.column = presumedLoc.getColumn();
+        }
+    }
+
+    diagnostics.push_back(std::move(diagnostic));
+}
+
+bool DiagnosticsCollector::errorLimitReached() const {
+    return fatalErrorOccurred ||
+        (errorLimit > 0 && getNumErrors() >= static_cast<unsigned>(errorLimit));
+}
+
+const std::vector<CompilationDiagnostic>& DiagnosticsCollector::getDiagnostics() const {
+    return diagnostics;
+}
+
+
+ErrorLimitConsumer::ErrorLimitConsumer(const DiagnosticsCollector& diagnostics_)
+    : diagnostics(diagnostics_)
+{}
+
+bool ErrorLimitConsumer::HandleTopLevelDecl(DeclGroupRef) {
+    // Returning false stops the parser
+    return !diagnostics.errorLimitReached();
+}
+
+}
+}
+
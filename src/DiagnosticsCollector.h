@@ -0,0 +1,52 @@
+//                        Caide C++ inliner
+//
+// This file is distributed under the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version. See LICENSE.TXT for details.
+
+#pragma once
+
+#include "caideInliner.hpp"
+
+#include <clang/AST/ASTConsumer.h>
+#include <clang/Basic/Diagnostic.h>
+
+#include <vector>
+
+
+namespace caide {
+namespace internal {
+
+// Stores diagnostics of a compilation instead of printing them.
+class DiagnosticsCollector: public clang::DiagnosticConsumer {
+public:
+    // errorLimit: number of errors after which the compilation should be aborted; 0 means no limit.
+    explicit DiagnosticsCollector(int errorLimit);
+
+    virtual void HandleDiagnostic(clang::DiagnosticsEngine::Level level,
+                                  const clang::Diagnostic& info) override;
+
+    bool errorLimitReached() const;
+
+    const std::vector<CompilationDiagnostic>& getDiagnostics() const;
+
+private:
+    const int errorLimit;
+    bool fatalErrorOccurred;
+    std::vector<CompilationDiagnostic> diagnostics;
+};
+
+// ASTConsumer that stops parsing once the error limit is reached.
+class ErrorLimitConsumer: public clang::ASTConsumer {
+public:
+    explicit ErrorLimitConsumer(const DiagnosticsCollector& diagnostics);
+
+    virtual bool HandleTopLevelDecl(clang::DeclGroupRef declGroup) override;
+
+private:
+    const DiagnosticsCollector& diagnostics;
+};
+
+}
+}
+
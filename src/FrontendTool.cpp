@@ -0,0 +1,515 @@
+//                        Caide C++ inliner
+//
+// This file is distributed under the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version. See LICENSE.TXT for details.
+
+#include "FrontendTool.h"
+#include "clang_version.h"
+#include "util.h"
+
+#include <clang/Basic/Diagnostic.h>
+#include <clang/Basic/DiagnosticOptions.h>
+#include <clang/Basic/FileManager.h>
+#include <clang/Basic/FileSystemOptions.h>
+#include <clang/Driver/Compilation.h>
+#include <clang/Driver/Driver.h>
+#include <clang/Driver/Job.h>
+#include <clang/Driver/Tool.h>
+#include <clang/Frontend/CompilerInvocation.h>
+#include <clang/Frontend/FrontendDiagnostic.h>
+#if CAIDE_CLANG_VERSION_AT_LEAST(3,7)
+#include <clang/Frontend/PCHContainerOperations.h>
+#endif
+#include <clang/Frontend/TextDiagnosticPrinter.h>
+#include <clang/Tooling/ArgumentsAdjusters.h>
+#include <clang/Tooling/CompilationDatabase.h>
+#include <clang/Tooling/Tooling.h>
+
+#include <llvm/ADT/SmallString.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Host.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+
+
+using namespace clang;
+using std::string;
+using std::vector;
+
+namespace caide {
+namespace internal {
+
+namespace {
+
+// The driver runs on a file with this name (and the extension of the actual file). In the
+// cached frontend options, it is replaced with the actual file.
+const char placeholderStem[] = "caide-driver-input";
+
+// A diagnostic of the driver (e.g. an unused option); the driver reports them without
+// a location
+struct DriverDiagnostic {
+    DiagnosticsEngine::Level level;
+    string message;
+};
+
+struct DriverCacheEntry {
+    // Frontend options for the placeholder file, or an empty list if they can't be reused
+    // for other files
+    vector<string> frontendOptions;
+    // Reported by the driver when the entry was created (warnings; errors are not cached)
+    vector<DriverDiagnostic> diagnostics;
+    // Whether the diagnostics have been reported in this process
+    bool reported = false;
+};
+
+// Key: everything the driver depends on
+struct DriverCache {
+    std::mutex mutex;
+    std::map<vector<string>, DriverCacheEntry> entries;
+    string filePath;
+    // Whether there are entries that are not in the file yet
+    bool modified = false;
+};
+
+DriverCache& getDriverCache() {
+    static DriverCache cache;
+    return cache;
+}
+
+// Records the diagnostics of the driver, passing them on to another consumer
+class DriverDiagnosticsRecorder: public DiagnosticConsumer {
+public:
+    DriverDiagnosticsRecorder(DiagnosticConsumer& consumer_, vector<DriverDiagnostic>& diagnostics_)
+        : consumer(consumer_)
+        , diagnostics(diagnostics_)
+    {}
+
+    virtual void HandleDiagnostic(DiagnosticsEngine::Level level, const Diagnostic& info) override {
+        DiagnosticConsumer::HandleDiagnostic(level, info);
+        llvm::SmallString<128> message;
+        info.FormatDiagnostic(message);
+        diagnostics.push_back(DriverDiagnostic{level, message.str()});
+        consumer.HandleDiagnostic(level, info);
+    }
+
+private:
+    DiagnosticConsumer& consumer;
+    vector<DriverDiagnostic>& diagnostics;
+};
+
+}
+
+static const char driverCacheSignature[] = "caide-driver-cache 2";
+
+// File format (text):
+//
+//   caide-driver-cache 2
+//   entry <number of key strings> <number of frontend options> <number of diagnostics>
+//   <key string>
+//   ...
+//   <frontend option>
+//   ...
+//   <diagnostic level> <message>
+//   ...
+static void loadDriverCache(DriverCache& cache) {
+    std::ifstream in(cache.filePath);
+    string line;
+    if (!std::getline(in, line) || line != driverCacheSignature)
+        return;
+
+    while (std::getline(in, line)) {
+        std::istringstream header(line);
+        string tag;
+        std::size_t numKeyStrings = 0, numOptions = 0, numDiagnostics = 0;
+        if (!(header >> tag >> numKeyStrings >> numOptions >> numDiagnostics) || tag != "entry")
+            return;
+        vector<string> key(numKeyStrings);
+        DriverCacheEntry entry;
+        entry.frontendOptions.resize(numOptions);
+        for (string& s : key) {
+            if (!std::getline(in, s))
+                return;
+        }
+        for (string& s : entry.frontendOptions) {
+            if (!std::getline(in, s))
+                return;
+        }
+        for (std::size_t i = 0; i < numDiagnostics; ++i) {
+            int level = 0;
+            string message;
+            if (!(in >> level) || level < DiagnosticsEngine::Ignored ||
+                    level > DiagnosticsEngine::Fatal || !std::getline(in, message) ||
+                    message.empty())
+                return;
+            message.erase(0, 1);
+            entry.diagnostics.push_back(
+                DriverDiagnostic{static_cast<DiagnosticsEngine::Level>(level), message});
+        }
+        cache.entries.insert(std::make_pair(std::move(key), std::move(entry)));
+    }
+}
+
+static bool hasNewLine(const vector<string>& strings) {
+    for (const string& s : strings) {
+        if (s.find('\n') != string::npos)
+            return true;
+    }
+    return false;
+}
+
+static bool hasNewLine(const vector<DriverDiagnostic>& diagnostics) {
+    for (const DriverDiagnostic& diagnostic : diagnostics) {
+        if (diagnostic.message.find('\n') != string::npos)
+            return true;
+    }
+    return false;
+}
+
+static bool writeDriverCache(const string& filePath,
+                             const std::map<vector<string>, DriverCacheEntry>& entries)
+{
+    const string temporaryPath = filePath + ".tmp";
+    {
+        std::ofstream out(temporaryPath);
+        out << driverCacheSignature << "\n";
+        for (const auto& entry : entries) {
+            const DriverCacheEntry& value = entry.second;
+            if (hasNewLine(entry.first) || hasNewLine(value.frontendOptions) ||
+                    hasNewLine(value.diagnostics))
+                continue;
+            out << "entry " << entry.first.size() << " " << value.frontendOptions.size()
+                << " " << value.diagnostics.size() << "\n";
+            for (const string& s : entry.first)
+                out << s << "\n";
+            for (const string& s : value.frontendOptions)
+                out << s << "\n";
+            for (const DriverDiagnostic& diagnostic : value.diagnostics)
+                out << static_cast<int>(diagnostic.level) << " " << diagnostic.message << "\n";
+        }
+        out.close();
+        if (!out) {
+            std::remove(temporaryPath.c_str());
+            return false;
+        }
+    }
+    if (std::rename(temporaryPath.c_str(), filePath.c_str()) != 0) {
+        // Windows doesn't replace an existing file
+        std::remove(filePath.c_str());
+        if (std::rename(temporaryPath.c_str(), filePath.c_str()) != 0) {
+            std::remove(temporaryPath.c_str());
+            return false;
+        }
+    }
+    return true;
+}
+
+void setDriverCacheFile(const string& filePath) {
+    DriverCache& cache = getDriverCache();
+    std::lock_guard<std::mutex> lock(cache.mutex);
+    if (cache.filePath == filePath)
+        return;
+    cache.filePath = filePath;
+    // Entries created before are written with the entries of the new file
+    cache.modified = !cache.entries.empty();
+    if (!filePath.empty())
+        loadDriverCache(cache);
+}
+
+void saveDriverCache() {
+    DriverCache& cache = getDriverCache();
+    string filePath;
+    std::map<vector<string>, DriverCacheEntry> entries;
+    {
+        std::lock_guard<std::mutex> lock(cache.mutex);
+        if (cache.filePath.empty() || !cache.modified)
+            return;
+        filePath = cache.filePath;
+        entries = cache.entries;
+        cache.modified = false;
+    }
+
+    // Stages running meanwhile are not blocked by the write
+    if (!writeDriverCache(filePath, entries)) {
+        std::lock_guard<std::mutex> lock(cache.mutex);
+        cache.modified = true;
+        throw std::runtime_error("Couldn't write the driver cache to " + filePath);
+    }
+}
+
+static string getMainExecutable() {
+    // Same as in ClangTool: the resource directory is found relative to the executable
+    static int staticSymbol;
+    return llvm::sys::fs::getMainExecutable("clang_tool", &staticSymbol);
+}
+
+static vector<string> getDriverCacheKey(const vector<string>& cmdLineOptions,
+                                        const string& extension)
+{
+    vector<string> key;
+    key.push_back(std::to_string(cmdLineOptions.size()));
+    key.insert(key.end(), cmdLineOptions.begin(), cmdLineOptions.end());
+    key.push_back(extension);
+    key.push_back(getMainExecutable());
+
+    llvm::SmallString<256> currentDirectory;
+    if (!llvm::sys::fs::current_path(currentDirectory))
+        key.push_back(currentDirectory.str());
+    else
+        key.push_back("");
+
+    // Environment variables that the driver reads
+    static const char* const environmentVariables[] = {
+        "PATH", "COMPILER_PATH", "CPATH", "C_INCLUDE_PATH", "CPLUS_INCLUDE_PATH",
+        "OBJC_INCLUDE_PATH", "OBJCPLUS_INCLUDE_PATH", "LIBRARY_PATH", "SDKROOT",
+        "MACOSX_DEPLOYMENT_TARGET", "CCC_OVERRIDE_OPTIONS", "INCLUDE",
+    };
+    for (const char* name : environmentVariables) {
+        const char* value = std::getenv(name);
+        key.push_back(value ? string(name) + "=" + value : string(name));
+    }
+    return key;
+}
+
+// The same as ClangTool and ToolInvocation do before running an action
+// If recordedDiagnostics is not null, the diagnostics are also stored there
+static bool runDriver(const vector<string>& cmdLineOptions, const string& filePath,
+                      DiagnosticConsumer* diagnosticConsumer, vector<string>& frontendOptions,
+                      vector<DriverDiagnostic>* recordedDiagnostics = nullptr)
+{
+    std::unique_ptr<tooling::FixedCompilationDatabase> compilationDatabase(
+        createCompilationDatabaseFromCommandLine(cmdLineOptions));
+    if (!compilationDatabase)
+        return false;
+    vector<tooling::CompileCommand> compileCommands =
+        compilationDatabase->getCompileCommands(filePath);
+    if (compileCommands.empty())
+        return false;
+
+    tooling::CommandLineArguments commandLine = compileCommands[0].CommandLine;
+#if CAIDE_CLANG_VERSION_AT_LEAST(3,8)
+    commandLine = tooling::getClangStripOutputAdjuster()(commandLine, filePath);
+    commandLine = tooling::getClangSyntaxOnlyAdjuster()(commandLine, filePath);
+#else
+    commandLine = tooling::getClangStripOutputAdjuster()(commandLine);
+    commandLine = tooling::getClangSyntaxOnlyAdjuster()(commandLine);
+#endif
+#if CAIDE_CLANG_VERSION_AT_LEAST(5,0)
+    commandLine = tooling::getClangStripDependencyFileAdjuster()(commandLine, filePath);
+#endif
+    commandLine[0] = getMainExecutable();
+
+    vector<const char*> argv;
+    for (const string& arg : commandLine)
+        argv.push_back(arg.c_str());
+
+    IntrusiveRefCntPtr<DiagnosticOptions> diagnosticOptions(new DiagnosticOptions());
+    TextDiagnosticPrinter diagnosticPrinter(llvm::errs(), &*diagnosticOptions);
+    DiagnosticConsumer& consumer = diagnosticConsumer ? *diagnosticConsumer : diagnosticPrinter;
+    std::unique_ptr<DriverDiagnosticsRecorder> recorder;
+    if (recordedDiagnostics)
+        recorder.reset(new DriverDiagnosticsRecorder(consumer, *recordedDiagnostics));
+    DiagnosticsEngine diagnostics(IntrusiveRefCntPtr<DiagnosticIDs>(new DiagnosticIDs()),
+        &*diagnosticOptions, recorder ? recorder.get() : &consumer, /*ShouldOwnClient=*/false);
+
+    driver::Driver compilerDriver(argv[0], llvm::sys::getDefaultTargetTriple(), diagnostics);
+    compilerDriver.setTitle("clang_based_tool");
+    // The input may be virtual
+    compilerDriver.setCheckInputsExist(false);
+    std::unique_ptr<driver::Compilation> compilation(compilerDriver.BuildCompilation(argv));
+    if (!compilation || diagnostics.hasErrorOccurred())
+        return false;
+
+    const driver::JobList& jobs = compilation->getJobs();
+    if (jobs.size() != 1 || !isa<driver::Command>(*jobs.begin())) {
+        string jobsDescription;
+        llvm::raw_string_ostream out(jobsDescription);
+        jobs.Print(out, "; ", true);
+        diagnostics.Report(diag::err_fe_expected_compiler_job) << out.str();
+        return false;
+    }
+
+    const driver::Command& command = cast<driver::Command>(*jobs.begin());
+    if (StringRef(command.getCreator().getName()) != "clang") {
+        diagnostics.Report(diag::err_fe_expected_clang_command);
+        return false;
+    }
+
+    const llvm::opt::ArgStringList& args = command.getArguments();
+    frontendOptions.assign(args.begin(), args.end());
+    return true;
+}
+
+// Reports diagnostics recorded when the driver ran for a cached entry
+static void reportDriverDiagnostics(const vector<DriverDiagnostic>& driverDiagnostics,
+                                    DiagnosticConsumer* diagnosticConsumer)
+{
+    if (driverDiagnostics.empty())
+        return;
+    IntrusiveRefCntPtr<DiagnosticOptions> diagnosticOptions(new DiagnosticOptions());
+    TextDiagnosticPrinter diagnosticPrinter(llvm::errs(), &*diagnosticOptions);
+    DiagnosticsEngine diagnostics(IntrusiveRefCntPtr<DiagnosticIDs>(new DiagnosticIDs()),
+        &*diagnosticOptions, diagnosticConsumer ? diagnosticConsumer : &diagnosticPrinter,
+        /*ShouldOwnClient=*/false);
+    for (const DriverDiagnostic& diagnostic : driverDiagnostics)
+        diagnostics.Report(diagnostics.getCustomDiagID(diagnostic.level, "%0")) << diagnostic.message;
+}
+
+// Replaces the placeholder file with filePath
+static bool instantiateFrontendOptions(const vector<string>& cachedOptions,
+                                       const string& placeholder, const string& filePath,
+                                       vector<string>& frontendOptions)
+{
+    frontendOptions.clear();
+    bool inputFound = false;
+    for (std::size_t i = 0; i < cachedOptions.size(); ++i) {
+        const string& option = cachedOptions[i];
+        if (option == placeholder) {
+            if (i > 0 && cachedOptions[i-1] == "-main-file-name") {
+                frontendOptions.push_back(llvm::sys::path::filename(filePath));
+            } else if (inputFound) {
+                return false;
+            } else {
+                inputFound = true;
+                frontendOptions.push_back(filePath);
+            }
+        } else if (option.find(placeholderStem) != string::npos) {
+            // E.g. an output file derived from the name of the input
+            return false;
+        } else {
+            frontendOptions.push_back(option);
+        }
+    }
+    return inputFound;
+}
+
+static bool getFrontendOptions(const vector<string>& cmdLineOptions, const string& filePath,
+                               DiagnosticConsumer* diagnosticConsumer,
+                               vector<string>& frontendOptions)
+{
+    const string extension = llvm::sys::path::extension(filePath);
+    const string placeholder = placeholderStem + extension;
+    const vector<string> key = getDriverCacheKey(cmdLineOptions, extension);
+
+    DriverCache& cache = getDriverCache();
+    vector<string> cachedOptions;
+    vector<DriverDiagnostic> cachedDiagnostics;
+    bool found = false;
+    {
+        std::lock_guard<std::mutex> lock(cache.mutex);
+        auto it = cache.entries.find(key);
+        if (it != cache.entries.end()) {
+            cachedOptions = it->second.frontendOptions;
+            // Like the driver, report the diagnostics once per process
+            if (!it->second.reported)
+                cachedDiagnostics = it->second.diagnostics;
+            it->second.reported = true;
+            found = true;
+        }
+    }
+
+    if (found) {
+        // Otherwise the driver runs for the file below
+        if (!cachedOptions.empty())
+            reportDriverDiagnostics(cachedDiagnostics, diagnosticConsumer);
+    } else {
+        DriverCacheEntry entry;
+        if (!runDriver(cmdLineOptions, placeholder, diagnosticConsumer, entry.frontendOptions,
+                       &entry.diagnostics))
+            return false;
+        vector<string> unused;
+        if (!instantiateFrontendOptions(entry.frontendOptions, placeholder, filePath, unused))
+            entry.frontendOptions.clear();
+        cachedOptions = entry.frontendOptions;
+        entry.reported = true;
+
+        // The file is written by saveDriverCache()
+        std::lock_guard<std::mutex> lock(cache.mutex);
+        cache.entries[key] = std::move(entry);
+        cache.modified = true;
+    }
+
+    if (!cachedOptions.empty() &&
+            instantiateFrontendOptions(cachedOptions, placeholder, filePath, frontendOptions))
+        return true;
+
+    return runDriver(cmdLineOptions, filePath, diagnosticConsumer, frontendOptions);
+}
+
+FrontendTool::FrontendTool(const vector<string>& cmdLineOptions_, const string& sourceFile_)
+    : cmdLineOptions(cmdLineOptions_)
+    , diagnosticConsumer(nullptr)
+    , files(new FileManager(FileSystemOptions()))
+{
+    // Same as ClangTool
+    llvm::SmallString<256> absolutePath(sourceFile_);
+    if (llvm::sys::fs::make_absolute(absolutePath))
+        sourceFile = sourceFile_;
+    else
+        sourceFile = absolutePath.str();
+}
+
+FrontendTool::~FrontendTool() {}
+
+void FrontendTool::setDiagnosticConsumer(DiagnosticConsumer* consumer) {
+    diagnosticConsumer = consumer;
+}
+
+void FrontendTool::mapVirtualFile(const string& filePath, const string& content) {
+    mappedFiles.emplace_back(filePath, content);
+}
+
+int FrontendTool::run(tooling::ToolAction* action) {
+    vector<string> frontendOptions;
+    if (!getFrontendOptions(cmdLineOptions, sourceFile, diagnosticConsumer, frontendOptions))
+        return 1;
+
+    // Skip -cc1
+    vector<const char*> args;
+    for (std::size_t i = 1; i < frontendOptions.size(); ++i)
+        args.push_back(frontendOptions[i].c_str());
+
+    IntrusiveRefCntPtr<DiagnosticOptions> diagnosticOptions(new DiagnosticOptions());
+    TextDiagnosticPrinter diagnosticPrinter(llvm::errs(), &*diagnosticOptions);
+    DiagnosticsEngine diagnostics(IntrusiveRefCntPtr<DiagnosticIDs>(new DiagnosticIDs()),
+        &*diagnosticOptions, diagnosticConsumer ? diagnosticConsumer : &diagnosticPrinter,
+        /*ShouldOwnClient=*/false);
+
+    std::unique_ptr<CompilerInvocation> invocation(new CompilerInvocation());
+    CompilerInvocation::CreateFromArgs(*invocation, args.data(), args.data() + args.size(),
+                                       diagnostics);
+    invocation->getFrontendOpts().DisableFree = false;
+    invocation->getCodeGenOpts().DisableFree = false;
+    invocation->getDependencyOutputOpts() = DependencyOutputOptions();
+    for (const auto& mappedFile : mappedFiles) {
+        std::unique_ptr<llvm::MemoryBuffer> buffer =
+            llvm::MemoryBuffer::getMemBuffer(mappedFile.second);
+        invocation->getPreprocessorOpts().addRemappedFile(mappedFile.first, buffer.release());
+    }
+
+#if CAIDE_CLANG_VERSION_AT_LEAST(5,0)
+    const bool success = action->runInvocation(std::move(invocation), files.get(),
+        std::make_shared<PCHContainerOperations>(), diagnosticConsumer);
+#elif CAIDE_CLANG_VERSION_AT_LEAST(3,7)
+    const bool success = action->runInvocation(invocation.release(), files.get(),
+        std::make_shared<PCHContainerOperations>(), diagnosticConsumer);
+#else
+    const bool success = action->runInvocation(invocation.release(), files.get(),
+                                               diagnosticConsumer);
+#endif
+    return success ? 0 : 1;
+}
+
+}
+}
+
@@ -0,0 +1,67 @@
+//                        Caide C++ inliner
+//
+// This file is distributed under the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version. See LICENSE.TXT for details.
+
+#pragma once
+
+#include <llvm/ADT/IntrusiveRefCntPtr.h>
+
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace clang {
+    class DiagnosticConsumer;
+    class FileManager;
+    namespace tooling {
+        class ToolAction;
+    }
+}
+
+namespace caide {
+namespace internal {
+
+// Runs frontend actions on a single file, like clang::tooling::ClangTool.
+//
+// ClangTool runs the clang driver before each action, to turn command line options into
+// frontend (cc1) options. That involves looking for a GCC installation, the resource directory
+// etc., and the result is the same for every action with the same options. Here the driver
+// runs once per set of options, working directory and environment in the process; frontend
+// options are cached and reused by all stages and jobs (see setDriverCacheFile()).
+class FrontendTool {
+public:
+    FrontendTool(const std::vector<std::string>& cmdLineOptions, const std::string& sourceFile);
+    ~FrontendTool();
+
+    // Diagnostics are printed to stderr if the consumer is null
+    void setDiagnosticConsumer(clang::DiagnosticConsumer* consumer);
+
+    // The compiler reads content instead of the file in all subsequent runs
+    void mapVirtualFile(const std::string& filePath, const std::string& content);
+
+    // Returns 0 on success. The file manager is shared by all runs.
+    int run(clang::tooling::ToolAction* action);
+
+private:
+    const std::vector<std::string> cmdLineOptions;
+    std::string sourceFile;
+    clang::DiagnosticConsumer* diagnosticConsumer;
+    llvm::IntrusiveRefCntPtr<clang::FileManager> files;
+    std::vector<std::pair<std::string, std::string>> mappedFiles;
+};
+
+// Persists the driver cache in a file, so that the driver doesn't run again in later
+// processes. Entries already in the file are loaded. The file must be deleted when
+// the toolchain (e.g. the GCC installation) changes. Cached entries include the warnings
+// of the driver, which are reported once per process as if the driver ran.
+void setDriverCacheFile(const std::string& filePath);
+
+// Writes the driver cache to the file set by setDriverCacheFile(), if there are new entries.
+// Throws std::runtime_error if the file can't be written.
+void saveDriverCache();
+
+}
+}
+
@@ -0,0 +1,71 @@
+//                        Caide C++ inliner
+//
+// This file is distributed under the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version. See LICENSE.TXT for details.
+
+#pragma once
+
+#include <cstdint>
+
+namespace caide {
+namespace internal {
+
+// Binary format of the dependency graph written by DependenciesCollector::writeBinaryGraph().
+// All numbers are in native byte order. Sections follow each other in this order, each one
+// starting at an offset that is a multiple of 8:
+//
+//   GraphFileHeader
+//   GraphNode nodes[numNodes]
+//   uint64_t edgeOffsets[numNodes + 1];    out-edges of node i are edgeTargets[edgeOffsets[i], edgeOffsets[i+1])
+//   uint32_t edgeTargets[numEdges]
+//   uint64_t stringOffsets[numStrings + 1]; string i is stringData[stringOffsets[i], stringOffsets[i+1])
+//   char     stringData[]
+//
+// Nodes are sorted by file name, position and name, and out-edges of a node by target,
+// so that the same input always produces the same file.
+// String 0 is always the empty string. The string table is last, so that nodes and edges can be
+// written as they are computed.
+
+const char graphFileMagic[8] = {'C', 'A', 'I', 'D', 'E', 'G', 'R', '2'};
+
+struct GraphFileHeader {
+    char magic[8];
+    std::uint64_t numStrings;
+    std::uint64_t numNodes;
+    std::uint64_t numEdges;
+    std::uint64_t stringOffsetsOffset;
+    std::uint64_t stringDataOffset;
+    std::uint64_t nodesOffset;
+    std::uint64_t edgeOffsetsOffset;
+    std::uint64_t edgeTargetsOffset;
+};
+
+enum GraphNodeFlags : std::uint32_t {
+    // The node is a root of the graph (main function or a 'caide keep' declaration)
+    GraphNodeIsRoot = 1,
+    // The node is a declaration from the main file
+    GraphNodeIsInMainFile = 2,
+};
+
+struct GraphNode {
+    // Indices in the string table
+    std::uint32_t name;
+    std::uint32_t kind;
+    std::uint32_t file;
+
+    std::uint32_t flags;
+
+    // Expansion range of the declaration
+    std::uint32_t beginLine;
+    std::uint32_t beginColumn;
+    std::uint32_t endLine;
+    std::uint32_t endColumn;
+};
+
+static_assert(sizeof(GraphFileHeader) == 72, "Unexpected layout of GraphFileHeader");
+static_assert(sizeof(GraphNode) == 32, "Unexpected layout of GraphNode");
+
+}
+}
+
@@ -0,0 +1,501 @@
+//                        Caide C++ inliner
+//
+// This file is distributed under the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version. See LICENSE.TXT for details.
+
+#include "InlinedCodeCache.h"
+#include "hash.h"
+#include "PreprocessorScanner.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+
+
+using std::size_t;
+using std::string;
+using std::uint64_t;
+using std::vector;
+
+namespace caide {
+namespace internal {
+
+// Manifest format (text):
+//
+//   caide-inline-cache 4
+//   key <hex>
+//   contents <hex hash of the cached code>
+//   header <hex hash> <hex hash of preprocessor directives, or -> <path>
+//   ...
+//   absent <path>
+//   ...
+//   segment <length> -
+//   segment <length> <header index> <begin anchor> <end anchor>
+//   ...
+//   diagnostic <severity> <line> <column> <escaped file> <escaped message>
+//   ...
+//
+// Segments make up the cached code in order. Segments of the first form are not copied
+// from a header (or can't be located in it later). A segment copied from a header is located
+// relative to the preprocessor directives of the header, which must stay unchanged for
+// the entry to be patched: an anchor is `start`, `end`, or `<directive index>+<offset>`.
+//
+// Absent paths are where the headers would have been found first if they existed (see
+// Inliner::getShadowingPaths()); the entry is valid only while none of them exists.
+//
+// Diagnostics are the warnings reported by the inline stage. In their text fields, whitespace
+// and backslashes are escaped as \s, \t, \r, \n and \\; an empty field is `-`, and `-` is `\-`.
+//
+// The contents file is written before the manifest, each to a temporary file renamed over
+// the previous one, so that an interrupted write leaves no entry that looks valid.
+
+static const char manifestSignature[] = "caide-inline-cache 4";
+
+namespace {
+
+struct CachedHeader {
+    string path;
+    uint64_t hash;
+    // Headers without a directives hash can't be patched
+    bool hasDirectivesHash;
+    uint64_t directivesHash;
+};
+
+struct Anchor {
+    enum class Kind { Start, End, Directive };
+    Kind kind;
+    size_t directive;
+    size_t offset;
+};
+
+struct CachedSegment {
+    size_t length;
+    // Index in the list of headers, or -1 if the segment can't be patched
+    int header;
+    Anchor begin;
+    Anchor end;
+};
+
+struct ScannedHeader {
+    string contents;
+    vector<PreprocessorDirective> directives;
+};
+
+}
+
+static bool readFile(const string& filePath, string& contents) {
+    std::ifstream in{filePath, std::ios::binary};
+    if (!in)
+        return false;
+    std::ostringstream buf;
+    buf << in.rdbuf();
+    contents = buf.str();
+    return true;
+}
+
+static bool fileExists(const string& filePath) {
+    std::ifstream in{filePath, std::ios::binary};
+    return static_cast<bool>(in);
+}
+
+static uint64_t hashDirectives(const ScannedHeader& header) {
+    uint64_t hash = fnv1aOffsetBasis;
+    for (const PreprocessorDirective& directive : header.directives) {
+        hash = fnv1aHash(header.contents.data() + directive.offset, directive.length, hash);
+        hash = fnv1aHash("", 1, hash);
+    }
+    return hash;
+}
+
+static bool toAnchor(const ScannedHeader& header, size_t offset, Anchor& anchor) {
+    if (offset == 0) {
+        anchor.kind = Anchor::Kind::Start;
+        return true;
+    }
+    if (offset == header.contents.size()) {
+        anchor.kind = Anchor::Kind::End;
+        return true;
+    }
+
+    // The last directive starting at or before offset
+    auto it = std::upper_bound(header.directives.begin(), header.directives.end(), offset,
+        [](size_t value, const PreprocessorDirective& directive) {
+            return value < directive.offset;
+        });
+    if (it == header.directives.begin())
+        return false;
+    --it;
+    if (offset - it->offset > it->length)
+        return false;
+    anchor.kind = Anchor::Kind::Directive;
+    anchor.directive = static_cast<size_t>(it - header.directives.begin());
+    anchor.offset = offset - it->offset;
+    return true;
+}
+
+static bool fromAnchor(const ScannedHeader& header, const Anchor& anchor, size_t& offset) {
+    switch (anchor.kind) {
+        case Anchor::Kind::Start:
+            offset = 0;
+            return true;
+        case Anchor::Kind::End:
+            offset = header.contents.size();
+            return true;
+        case Anchor::Kind::Directive:
+        default:
+            if (anchor.directive >= header.directives.size() ||
+                    anchor.offset > header.directives[anchor.directive].length)
+                return false;
+            offset = header.directives[anchor.directive].offset + anchor.offset;
+            return true;
+    }
+}
+
+static std::ostream& operator<<(std::ostream& out, const Anchor& anchor) {
+    switch (anchor.kind) {
+        case Anchor::Kind::Start:
+            return out << "start";
+        case Anchor::Kind::End:
+            return out << "end";
+        case Anchor::Kind::Directive:
+        default:
+            return out << anchor.directive << "+" << anchor.offset;
+    }
+}
+
+static bool parseAnchor(const string& text, Anchor& anchor) {
+    if (text == "start") {
+        anchor.kind = Anchor::Kind::Start;
+        return true;
+    }
+    if (text == "end") {
+        anchor.kind = Anchor::Kind::End;
+        return true;
+    }
+    std::istringstream in{text};
+    char plus = 0;
+    anchor.kind = Anchor::Kind::Directive;
+    return in >> anchor.directive >> plus >> anchor.offset && plus == '+';
+}
+
+static const char escapedChars[] = " \t\r\n\\";
+static const char escapes[] = "strn\\";
+
+static string escape(const string& text) {
+    if (text.empty())
+        return "-";
+    if (text == "-")
+        return "\\-";
+    string escaped;
+    for (char c : text) {
+        const char* p = std::strchr(escapedChars, c);
+        if (c != '\0' && p) {
+            escaped += '\\';
+            escaped += escapes[p - escapedChars];
+        } else {
+            escaped += c;
+        }
+    }
+    return escaped;
+}
+
+static bool unescape(const string& text, string& unescaped) {
+    unescaped.clear();
+    if (text == "-")
+        return true;
+    if (text == "\\-") {
+        unescaped = "-";
+        return true;
+    }
+    for (size_t i = 0; i < text.size(); ++i) {
+        if (text[i] != '\\') {
+            unescaped += text[i];
+            continue;
+        }
+        const char* p = ++i < text.size() ? std::strchr(escapes, text[i]) : nullptr;
+        if (!p || text[i] == '\0')
+            return false;
+        unescaped += escapedChars[p - escapes];
+    }
+    return true;
+}
+
+// Replaces the file atomically where the file system allows it
+static bool writeFile(const string& filePath, const string& contents, std::ios::openmode mode) {
+    const string temporaryPath = filePath + ".tmp";
+    {
+        std::ofstream out(temporaryPath, mode);
+        out << contents;
+        out.close();
+        if (!out) {
+            std::remove(temporaryPath.c_str());
+            return false;
+        }
+    }
+    if (std::rename(temporaryPath.c_str(), filePath.c_str()) != 0) {
+        // Windows doesn't replace an existing file
+        std::remove(filePath.c_str());
+        if (std::rename(temporaryPath.c_str(), filePath.c_str()) != 0) {
+            std::remove(temporaryPath.c_str());
+            return false;
+        }
+    }
+    return true;
+}
+
+static void writeEntry(const string& manifestPath, const string& contentsPath, uint64_t key,
+                       const string& inlinedCode, const vector<CachedHeader>& headers,
+                       const vector<string>& absentPaths,
+                       const vector<CachedSegment>& segments,
+                       const vector<CompilationDiagnostic>& diagnostics)
+{
+    std::ostringstream manifest;
+    manifest << manifestSignature << "\n";
+    manifest << std::hex;
+    manifest << "key " << key << "\n";
+    manifest << "contents " << fnv1aHash(inlinedCode) << "\n";
+    for (const CachedHeader& header : headers) {
+        manifest << "header " << header.hash << " ";
+        if (header.hasDirectivesHash)
+            manifest << header.directivesHash;
+        else
+            manifest << "-";
+        manifest << " " << header.path << "\n";
+    }
+    manifest << std::dec;
+    for (const string& path : absentPaths)
+        manifest << "absent " << path << "\n";
+    for (const CachedSegment& segment : segments) {
+        manifest << "segment " << segment.length << " ";
+        if (segment.header < 0)
+            manifest << "-";
+        else
+            manifest << segment.header << " " << segment.begin << " " << segment.end;
+        manifest << "\n";
+    }
+    for (const CompilationDiagnostic& diagnostic : diagnostics) {
+        manifest << "diagnostic " << static_cast<int>(diagnostic.severity) << " "
+                 << diagnostic.line << " " << diagnostic.column << " "
+                 << escape(diagnostic.file) << " " << escape(diagnostic.message) << "\n";
+    }
+
+    // The old manifest doesn't match the new contents; remove it first in case writing fails
+    std::remove(manifestPath.c_str());
+    if (writeFile(contentsPath, inlinedCode, std::ios::binary))
+        writeFile(manifestPath, manifest.str(), std::ios::out);
+}
+
+InlinedCodeCache::InlinedCodeCache(const string& directory, const string& fileNamePrefix)
+    : manifestPath{directory + "/" + fileNamePrefix + "inline-cache.manifest"}
+    , contentsPath{directory + "/" + fileNamePrefix + "inline-cache.cpp"}
+{}
+
+bool InlinedCodeCache::lookup(uint64_t key, string& inlinedCode,
+                              vector<CompilationDiagnostic>& diagnostics) const
+{
+    std::ifstream manifest{manifestPath};
+    string line;
+    if (!std::getline(manifest, line) || line != manifestSignature)
+        return false;
+
+    uint64_t storedKey = 0, contentsHash = 0;
+    vector<CachedHeader> headers;
+    vector<string> absentPaths;
+    vector<CachedSegment> segments;
+    vector<CompilationDiagnostic> storedDiagnostics;
+    bool keyRead = false, contentsRead = false;
+    while (std::getline(manifest, line)) {
+        std::istringstream in{line};
+        string tag;
+        in >> tag;
+        if (tag == "key") {
+            keyRead = static_cast<bool>(in >> std::hex >> storedKey);
+            if (!keyRead || storedKey != key)
+                return false;
+        } else if (tag == "contents") {
+            contentsRead = static_cast<bool>(in >> std::hex >> contentsHash);
+        } else if (tag == "header") {
+            CachedHeader header;
+            string directivesHash;
+            if (!(in >> std::hex >> header.hash >> directivesHash))
+                return false;
+            header.hasDirectivesHash = directivesHash != "-";
+            header.directivesHash = std::strtoull(directivesHash.c_str(), nullptr, 16);
+            std::getline(in, header.path);
+            if (header.path.size() < 2)
+                return false;
+            header.path.erase(0, 1);
+            headers.push_back(std::move(header));
+        } else if (tag == "absent") {
+            string path;
+            std::getline(in, path);
+            if (path.size() < 2)
+                return false;
+            path.erase(0, 1);
+            // A header created there since takes precedence over the one the entry was built with
+            if (fileExists(path))
+                return false;
+            absentPaths.push_back(std::move(path));
+        } else if (tag == "segment") {
+            CachedSegment segment;
+            string header;
+            if (!(in >> segment.length >> header))
+                return false;
+            segment.header = -1;
+            if (header != "-") {
+                string begin, end;
+                segment.header = std::atoi(header.c_str());
+                if (segment.header < 0 || segment.header >= static_cast<int>(headers.size()) ||
+                        !(in >> begin >> end) ||
+                        !parseAnchor(begin, segment.begin) || !parseAnchor(end, segment.end))
+                    return false;
+            }
+            segments.push_back(segment);
+        } else if (tag == "diagnostic") {
+            CompilationDiagnostic diagnostic;
+            int severity = 0;
+            string file, message;
+            const int maxSeverity = static_cast<int>(CompilationDiagnostic::Severity::Fatal);
+            if (!(in >> severity >> diagnostic.line >> diagnostic.column >> file >> message) ||
+                    severity < 0 || severity > maxSeverity ||
+                    !unescape(file, diagnostic.file) || !unescape(message, diagnostic.message))
+                return false;
+            diagnostic.severity = static_cast<CompilationDiagnostic::Severity>(severity);
+            storedDiagnostics.push_back(std::move(diagnostic));
+        } else {
+            return false;
+        }
+    }
+    if (!keyRead || !contentsRead)
+        return false;
+
+    // Headers that have changed since the entry was stored, by index
+    std::map<int, ScannedHeader> changedHeaders;
+    for (size_t i = 0; i < headers.size(); ++i) {
+        ScannedHeader header;
+        if (!readFile(headers[i].path, header.contents))
+            return false;
+        if (fnv1aHash(header.contents) == headers[i].hash)
+            continue;
+        if (!headers[i].hasDirectivesHash)
+            return false;
+        header.directives = scanDirectives(header.contents);
+        if (hashDirectives(header) != headers[i].directivesHash)
+            return false;
+        changedHeaders[static_cast<int>(i)] = std::move(header);
+    }
+
+    string contents;
+    if (!readFile(contentsPath, contents) || fnv1aHash(contents) != contentsHash)
+        return false;
+
+    if (!changedHeaders.empty()) {
+        // Copy everything except segments of changed headers from the cached code
+        string patched;
+        size_t pos = 0;
+        for (CachedSegment& segment : segments) {
+            if (segment.length > contents.size() - pos)
+                return false;
+            auto it = changedHeaders.find(segment.header);
+            if (it == changedHeaders.end()) {
+                patched.append(contents, pos, segment.length);
+            } else {
+                size_t begin = 0, end = 0;
+                if (!fromAnchor(it->second, segment.begin, begin) ||
+                        !fromAnchor(it->second, segment.end, end) || begin > end)
+                    return false;
+                patched.append(it->second.contents, begin, end - begin);
+                pos += segment.length;
+                segment.length = end - begin;
+                continue;
+            }
+            pos += segment.length;
+        }
+        if (pos != contents.size())
+            return false;
+
+        for (const auto& header : changedHeaders)
+            headers[header.first].hash = fnv1aHash(header.second.contents);
+        contents.swap(patched);
+        writeEntry(manifestPath, contentsPath, key, contents, headers, absentPaths, segments,
+                   storedDiagnostics);
+    }
+
+    inlinedCode.swap(contents);
+    diagnostics.swap(storedDiagnostics);
+    return true;
+}
+
+void InlinedCodeCache::store(uint64_t key, const string& inlinedCode,
+                             const std::set<string>& includedHeaders,
+                             const std::set<string>& shadowingPaths,
+                             const vector<InlinedSegment>& segmentMap,
+                             const vector<CompilationDiagnostic>& diagnostics) const
+{
+    vector<CachedHeader> headers;
+    vector<ScannedHeader> scannedHeaders;
+    std::map<string, int> headerIndex;
+    for (const string& headerPath : includedHeaders) {
+        ScannedHeader scanned;
+        // A header that can't be read can't be validated later either
+        if (!readFile(headerPath, scanned.contents))
+            return;
+        scanned.directives = scanDirectives(scanned.contents);
+
+        CachedHeader header;
+        header.path = headerPath;
+        header.hash = fnv1aHash(scanned.contents);
+        header.hasDirectivesHash = true;
+        header.directivesHash = hashDirectives(scanned);
+
+        headerIndex[headerPath] = static_cast<int>(headers.size());
+        headers.push_back(std::move(header));
+        scannedHeaders.push_back(std::move(scanned));
+    }
+
+    size_t totalLength = 0;
+    for (const InlinedSegment& segment : segmentMap)
+        totalLength += segment.length;
+    const bool haveSegmentMap = totalLength == inlinedCode.size() && !segmentMap.empty();
+
+    vector<CachedSegment> segments;
+    for (const InlinedSegment& inlinedSegment : segmentMap) {
+        if (!haveSegmentMap)
+            break;
+        CachedSegment segment;
+        segment.length = inlinedSegment.length;
+        segment.header = -1;
+        auto it = headerIndex.find(inlinedSegment.file);
+        if (it != headerIndex.end()) {
+            const ScannedHeader& header = scannedHeaders[it->second];
+            if (inlinedSegment.fileOffset + inlinedSegment.length <= header.contents.size() &&
+                    toAnchor(header, inlinedSegment.fileOffset, segment.begin) &&
+                    toAnchor(header, inlinedSegment.fileOffset + inlinedSegment.length,
+                             segment.end))
+                segment.header = it->second;
+            else
+                headers[it->second].hasDirectivesHash = false;
+        }
+        segments.push_back(segment);
+    }
+
+    if (!haveSegmentMap) {
+        for (CachedHeader& header : headers)
+            header.hasDirectivesHash = false;
+    }
+
+    const vector<string> absentPaths(shadowingPaths.begin(), shadowingPaths.end());
+    writeEntry(manifestPath, contentsPath, key, inlinedCode, headers, absentPaths, segments,
+               diagnostics);
+}
+
+}
+}
+
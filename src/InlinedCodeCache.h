@@ -0,0 +1,57 @@
+//                        Caide C++ inliner
+//
+// This file is distributed under the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version. See LICENSE.TXT for details.
+
+#pragma once
+
+#include "inliner.h"
+
+#include <cstdint>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace caide {
+namespace internal {
+
+// Persists the result of the first inliner stage between runs.
+//
+// An entry is identified by a key computed by the caller from everything the stage
+// depends on except header files; the entry itself records the contents hashes of
+// all headers included from user code and is valid only while they stay the same and
+// no header is created where the include directives would find it first.
+// Only one entry (the last stored) is kept per file name prefix.
+//
+// If the entry is stored with the segment map of the result, a header whose text has
+// changed but whose preprocessor directives haven't is not a reason to discard the entry:
+// the segments copied from the header are replaced with its new text instead.
+class InlinedCodeCache {
+public:
+    // Files of the cache are named <directory>/<fileNamePrefix>inline-cache.*
+    InlinedCodeCache(const std::string& directory, const std::string& fileNamePrefix);
+
+    // Returns false if there is no valid entry for the key. If the entry has been patched,
+    // the patched entry replaces the stored one. diagnostics are those reported when
+    // the entry was stored.
+    bool lookup(std::uint64_t key, std::string& inlinedCode,
+                std::vector<CompilationDiagnostic>& diagnostics) const;
+
+    // shadowingPaths are those of Inliner::getShadowingPaths().
+    // segmentMap may be empty, in which case the entry can't be patched.
+    // Failure to write the entry is not an error: the next lookup doesn't find it.
+    void store(std::uint64_t key, const std::string& inlinedCode,
+               const std::set<std::string>& includedHeaders,
+               const std::set<std::string>& shadowingPaths,
+               const std::vector<InlinedSegment>& segmentMap,
+               const std::vector<CompilationDiagnostic>& diagnostics) const;
+
+private:
+    const std::string manifestPath;
+    const std::string contentsPath;
+};
+
+}
+}
+
@@ -0,0 +1,69 @@
+//                        Caide C++ inliner
+//
+// This file is distributed under the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version. See LICENSE.TXT for details.
+
+#include "MappedFile.h"
+
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+
+#ifndef _WIN32
+# include <fcntl.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <unistd.h>
+#endif
+
+
+using std::string;
+
+namespace caide {
+namespace internal {
+
+MappedFile::MappedFile(const string& filePath)
+    : data(nullptr)
+    , length(0)
+{
+#ifdef _WIN32
+    std::ifstream in{filePath, std::ios::binary};
+    if (!in)
+        throw std::runtime_error("Couldn't open " + filePath);
+    contents.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    data = contents.data();
+    length = contents.size();
+#else
+    int fd = ::open(filePath.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw std::runtime_error("Couldn't open " + filePath);
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+        ::close(fd);
+        throw std::runtime_error("Couldn't stat " + filePath);
+    }
+    length = static_cast<std::size_t>(st.st_size);
+    if (length > 0) {
+        void* addr = ::mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+        if (addr == MAP_FAILED) {
+            ::close(fd);
+            throw std::runtime_error("Couldn't map " + filePath);
+        }
+        data = static_cast<const char*>(addr);
+    }
+    ::close(fd);
+#endif
+}
+
+MappedFile::~MappedFile() {
+#ifndef _WIN32
+    if (data)
+        ::munmap(const_cast<char*>(data), length);
+#endif
+}
+
+}
+}
+
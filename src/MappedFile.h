@@ -0,0 +1,38 @@
+//                        Caide C++ inliner
+//
+// This file is distributed under the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version. See LICENSE.TXT for details.
+
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace caide {
+namespace internal {
+
+// Read-only view of a whole file. On Windows the file is simply read into memory.
+class MappedFile {
+public:
+    explicit MappedFile(const std::string& filePath);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char* begin() const { return data; }
+    std::size_t size() const { return length; }
+
+private:
+    const char* data;
+    std::size_t length;
+#ifdef _WIN32
+    std::vector<char> contents;
+#endif
+};
+
+}
+}
+
@@ -0,0 +1,349 @@
+//                        Caide C++ inliner
+//
+// This file is distributed under the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version. See LICENSE.TXT for details.
+
+#include "OpaqueSystemHeaders.h"
+
+#include <clang/Basic/SourceManager.h>
+#include <clang/Lex/Lexer.h>
+#include <clang/Lex/MacroInfo.h>
+#include <clang/Lex/Preprocessor.h>
+
+#include <cctype>
+#include <cstring>
+#include <vector>
+
+
+using namespace clang;
+using std::set;
+using std::string;
+using std::vector;
+
+namespace caide {
+namespace internal {
+
+static bool isIdentifierStart(char c) {
+    return std::isalpha(static_cast<unsigned char>(c)) || c == '_';
+}
+
+static bool isIdentifierChar(char c) {
+    return std::isalnum(static_cast<unsigned char>(c)) || c == '_';
+}
+
+// Identifiers and parentheses of a preprocessor condition; numbers, literals, comments
+// and other punctuation are skipped
+static vector<string> tokenizeCondition(StringRef text) {
+    vector<string> tokens;
+    size_t i = 0;
+    while (i < text.size()) {
+        const char c = text[i];
+        if (isIdentifierStart(c)) {
+            const size_t start = i;
+            while (i < text.size() && isIdentifierChar(text[i]))
+                ++i;
+            tokens.push_back(text.substr(start, i - start).str());
+        } else if (std::isdigit(static_cast<unsigned char>(c))) {
+            // pp-number, e.g. 201103L
+            while (i < text.size() && (isIdentifierChar(text[i]) || text[i] == '.' || text[i] == '\''))
+                ++i;
+        } else if (c == '\'' || c == '"') {
+            ++i;
+            while (i < text.size() && text[i] != c) {
+                if (text[i] == '\\')
+                    ++i;
+                ++i;
+            }
+            ++i;
+        } else if (text.substr(i).startswith("//")) {
+            break;
+        } else if (text.substr(i).startswith("/*")) {
+            const size_t end = text.find("*/", i + 2);
+            i = end == StringRef::npos ? text.size() : end + 2;
+        } else {
+            if (c == '(' || c == ')')
+                tokens.push_back(string(1, c));
+            ++i;
+        }
+    }
+    return tokens;
+}
+
+// Skips whitespace and comments
+static StringRef skipBlank(StringRef text) {
+    while (!text.empty()) {
+        if (std::isspace(static_cast<unsigned char>(text[0]))) {
+            text = text.substr(1);
+        } else if (text.startswith("//")) {
+            const size_t end = text.find('\n');
+            text = end == StringRef::npos ? StringRef() : text.substr(end);
+        } else if (text.startswith("/*")) {
+            const size_t end = text.find("*/", 2);
+            text = end == StringRef::npos ? StringRef() : text.substr(end + 2);
+        } else {
+            break;
+        }
+    }
+    return text;
+}
+
+static StringRef skipSpaces(StringRef text) {
+    return text.ltrim(" \t");
+}
+
+static bool startsWith(const string& s, const char* prefix) {
+    return s.compare(0, std::strlen(prefix), prefix) == 0;
+}
+
+// Whether a macro with this name may be defined in a system header. Other macros, such as
+// LOCAL or ONLINE_JUDGE, are defined by the user or not at all.
+static bool mayBeSystemMacro(const string& name) {
+    // Reserved for the implementation
+    if (name.find("__") != string::npos ||
+            (name.size() >= 2 && name[0] == '_' && std::isupper(static_cast<unsigned char>(name[1]))))
+        return true;
+
+    // Standard C and POSIX macros
+    static const char* const names[] = {
+        "NULL", "EOF", "BUFSIZ", "FILENAME_MAX", "FOPEN_MAX", "TMP_MAX", "L_tmpnam", "RAND_MAX",
+        "CHAR_BIT", "CHAR_MIN", "CHAR_MAX", "MB_LEN_MAX", "MB_CUR_MAX", "CLOCKS_PER_SEC",
+        "TIME_UTC", "HUGE_VAL", "HUGE_VALF", "HUGE_VALL", "INFINITY", "NAN", "DECIMAL_DIG",
+        "WEOF", "PATH_MAX", "errno", "assert", "stdin", "stdout", "stderr", "offsetof", "bool",
+        "true", "false", "setjmp", "va_arg", "va_copy", "va_end", "va_start", "complex",
+        "imaginary", "alignas", "alignof", "noreturn", "static_assert", "thread_local", "unix",
+        "linux",
+    };
+    for (const char* systemName : names) {
+        if (name == systemName)
+            return true;
+    }
+
+    static const char* const prefixes[] = {
+        "INT_", "INT8_", "INT16_", "INT32_", "INT64_", "INTMAX_", "INTPTR_",
+        "UINT_", "UINT8_", "UINT16_", "UINT32_", "UINT64_", "UINTMAX_", "UINTPTR_",
+        "SCHAR_", "UCHAR_", "SHRT_", "USHRT_", "LONG_", "ULONG_", "LLONG_", "ULLONG_",
+        "SIZE_", "PTRDIFF_", "WCHAR_", "WINT_", "SIG_ATOMIC_", "FLT_", "DBL_", "LDBL_",
+        "EXIT_", "SEEK_", "LC_", "FP_", "MATH_", "ATOMIC_", "M_", "SIG", "O_", "S_I",
+    };
+    for (const char* prefix : prefixes) {
+        if (startsWith(name, prefix))
+            return true;
+    }
+
+    // Format macros of <cinttypes>, e.g. PRId64 or SCNxPTR
+    if ((startsWith(name, "PRI") || startsWith(name, "SCN")) && name.size() > 3 &&
+            string("diouxX").find(name[3]) != string::npos)
+        return true;
+
+    // errno values, e.g. EDOM or ENOENT
+    if (name.size() >= 3 && name[0] == 'E') {
+        bool isErrnoName = true;
+        for (char c : name)
+            isErrnoName = isErrnoName && (std::isupper(static_cast<unsigned char>(c)) ||
+                                          std::isdigit(static_cast<unsigned char>(c)));
+        if (isErrnoName)
+            return true;
+    }
+
+    return false;
+}
+
+OpaqueSystemHeaders::OpaqueSystemHeaders(Preprocessor& preprocessor_)
+    : preprocessor(preprocessor_)
+    , systemHeaderSkipped(false)
+    , unknownMacroUsed(false)
+{}
+
+bool OpaqueSystemHeaders::dependsOnSystemMacros() const {
+    return unknownMacroUsed || !undefinedMacros.empty();
+}
+
+void OpaqueSystemHeaders::FileChanged(SourceLocation /*Loc*/, FileChangeReason Reason,
+                                      SrcMgr::CharacteristicKind FileType, FileID /*PrevFID*/)
+{
+    if (Reason != PPCallbacks::EnterFile || FileType == SrcMgr::C_User)
+        return;
+    // The lexer of the new file is already active. There is no PTH in caide,
+    // so it is a raw Lexer.
+    if (Lexer* lexer = static_cast<Lexer*>(preprocessor.getCurrentLexer())) {
+        lexer->cutOffLexing();
+        systemHeaderSkipped = true;
+    }
+}
+
+void OpaqueSystemHeaders::MacroDefined(const Token& MacroNameTok, const MacroDirective* MD) {
+    const IdentifierInfo* identifier = MacroNameTok.getIdentifierInfo();
+    const MacroInfo* macro = MD ? MD->getMacroInfo() : nullptr;
+    if (identifier && macro && guardNameLoc.isValid() && macro->isObjectLike() &&
+            macro->getNumTokens() == 0)
+    {
+        // The text from the name in #ifndef to the name in this #define must be
+        // `NAME`, blank lines and comments, and `#define `
+        const StringRef name = identifier->getName();
+        StringRef text = getFileText(guardNameLoc, MacroNameTok.getLocation());
+        if (text.startswith(name)) {
+            text = skipBlank(text.substr(name.size()));
+            if (text.startswith("#")) {
+                text = skipSpaces(text.substr(1));
+                if (text.startswith("define") && skipSpaces(text.substr(6)).empty())
+                    guardCandidates[guardIfndefLoc.getRawEncoding()] = name.str();
+            }
+        }
+    }
+    guardIfndefLoc = guardNameLoc = SourceLocation();
+}
+
+bool OpaqueSystemHeaders::isUserCodeAfterSkippedHeader(SourceLocation loc) const {
+    // Before the first system header, all conditions are evaluated exactly
+    if (!systemHeaderSkipped || loc.isInvalid())
+        return false;
+    const SourceManager& sourceManager = preprocessor.getSourceManager();
+    return !sourceManager.isInSystemHeader(loc) && sourceManager.getFileID(loc).isValid();
+}
+
+StringRef OpaqueSystemHeaders::getFileText(SourceLocation begin, SourceLocation end) const {
+    const SourceManager& sourceManager = preprocessor.getSourceManager();
+    const FileID file = sourceManager.getFileID(begin);
+    if (!begin.isFileID() || (end.isValid() &&
+            (!end.isFileID() || sourceManager.getFileID(end) != file)))
+        return StringRef();
+    bool invalid = false;
+    const StringRef buffer = sourceManager.getBufferData(file, &invalid);
+    if (invalid)
+        return StringRef();
+    const unsigned beginOffset = sourceManager.getFileOffset(begin);
+    const unsigned endOffset = end.isValid() ? sourceManager.getFileOffset(end)
+                                             : static_cast<unsigned>(buffer.size());
+    if (beginOffset > endOffset || endOffset > buffer.size())
+        return StringRef();
+    return buffer.substr(beginOffset, endOffset - beginOffset);
+}
+
+void OpaqueSystemHeaders::checkMacroName(const Token& macroNameTok) {
+    if (!isUserCodeAfterSkippedHeader(macroNameTok.getLocation()))
+        return;
+    if (const IdentifierInfo* identifier = macroNameTok.getIdentifierInfo()) {
+        const string name = identifier->getName().str();
+        if (!preprocessor.isMacroDefined(identifier) && mayBeSystemMacro(name))
+            undefinedMacros.insert(name);
+    }
+}
+
+void OpaqueSystemHeaders::checkCondition(SourceRange conditionRange) {
+    if (!isUserCodeAfterSkippedHeader(conditionRange.getBegin()))
+        return;
+
+    bool invalid = false;
+    StringRef text = Lexer::getSourceText(CharSourceRange::getCharRange(conditionRange),
+        preprocessor.getSourceManager(), preprocessor.getLangOpts(), &invalid);
+    if (invalid) {
+        unknownMacroUsed = true;
+        return;
+    }
+
+    const vector<string> tokens = tokenizeCondition(text);
+    for (size_t i = 0; i < tokens.size(); ++i) {
+        const string& token = tokens[i];
+        if (token == "(" || token == ")" || token == "defined" || token == "true" || token == "false")
+            continue;
+
+        const IdentifierInfo* identifier = preprocessor.getIdentifierInfo(token);
+        const MacroInfo* macro = preprocessor.getMacroInfo(identifier);
+        if (macro && macro->isBuiltinMacro()) {
+            // Arguments of __has_include, __has_feature etc. are not macros
+            if (i + 1 < tokens.size() && tokens[i+1] == "(") {
+                int depth = 0;
+                for (++i; i < tokens.size(); ++i) {
+                    if (tokens[i] == "(")
+                        ++depth;
+                    else if (tokens[i] == ")" && --depth == 0)
+                        break;
+                }
+            }
+            continue;
+        }
+
+        set<string> visitedMacros;
+        checkIdentifier(token, visitedMacros);
+    }
+}
+
+void OpaqueSystemHeaders::checkIdentifier(const string& name, set<string>& visitedMacros) {
+    if (!visitedMacros.insert(name).second)
+        return;
+
+    const IdentifierInfo* identifier = preprocessor.getIdentifierInfo(name);
+    const MacroInfo* macro = preprocessor.getMacroInfo(identifier);
+    if (!macro) {
+        if (mayBeSystemMacro(name))
+            undefinedMacros.insert(name);
+    } else if (!macro->isObjectLike()) {
+        // Parameters can't be told apart from other identifiers in the body
+        unknownMacroUsed = true;
+    } else {
+        for (auto it = macro->tokens_begin(); it != macro->tokens_end(); ++it) {
+            if (const IdentifierInfo* bodyIdentifier = it->getIdentifierInfo())
+                checkIdentifier(bodyIdentifier->getName().str(), visitedMacros);
+        }
+    }
+}
+
+void OpaqueSystemHeaders::If(SourceLocation /*Loc*/, SourceRange ConditionRange,
+                             ConditionValueKind /*ConditionValue*/)
+{
+    checkCondition(ConditionRange);
+}
+
+#if CAIDE_CLANG_VERSION_AT_LEAST(3,7)
+void OpaqueSystemHeaders::Ifdef(SourceLocation /*Loc*/, const Token& MacroNameTok, const MacroDefinition&)
+#else
+void OpaqueSystemHeaders::Ifdef(SourceLocation /*Loc*/, const Token& MacroNameTok, const MacroDirective*)
+#endif
+{
+    checkMacroName(MacroNameTok);
+}
+
+#if CAIDE_CLANG_VERSION_AT_LEAST(3,7)
+void OpaqueSystemHeaders::Ifndef(SourceLocation Loc, const Token& MacroNameTok, const MacroDefinition&)
+#else
+void OpaqueSystemHeaders::Ifndef(SourceLocation Loc, const Token& MacroNameTok, const MacroDirective*)
+#endif
+{
+    checkMacroName(MacroNameTok);
+
+    // Only blank lines and comments may precede the #ifndef of an include guard
+    guardIfndefLoc = guardNameLoc = SourceLocation();
+    if (!isUserCodeAfterSkippedHeader(Loc))
+        return;
+    const SourceManager& sourceManager = preprocessor.getSourceManager();
+    StringRef text = getFileText(sourceManager.getLocForStartOfFile(sourceManager.getFileID(Loc)), Loc);
+    text = text.rtrim(" \t");
+    if (text.endswith("#") && skipBlank(text.drop_back()).empty()) {
+        guardIfndefLoc = Loc;
+        guardNameLoc = MacroNameTok.getLocation();
+    }
+}
+
+void OpaqueSystemHeaders::Elif(SourceLocation /*Loc*/, SourceRange ConditionRange,
+                               ConditionValueKind ConditionValue, SourceLocation /*IfLoc*/)
+{
+    // The condition doesn't matter if a previous branch has been selected
+    if (ConditionValue != CVK_NotEvaluated)
+        checkCondition(ConditionRange);
+}
+
+void OpaqueSystemHeaders::Endif(SourceLocation Loc, SourceLocation IfLoc) {
+    auto it = guardCandidates.find(IfLoc.getRawEncoding());
+    if (it == guardCandidates.end())
+        return;
+    // Only blank lines and comments may follow the #endif of an include guard
+    const StringRef text = getFileText(Loc, SourceLocation());
+    if (text.startswith("endif") && skipBlank(text.substr(5)).empty())
+        undefinedMacros.erase(it->second);
+    guardCandidates.erase(it);
+}
+
+}
+}
+
@@ -0,0 +1,88 @@
+//                        Caide C++ inliner
+//
+// This file is distributed under the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version. See LICENSE.TXT for details.
+
+#pragma once
+
+#include "clang_version.h"
+
+#include <clang/Basic/SourceLocation.h>
+#include <clang/Lex/PPCallbacks.h>
+
+#include <map>
+#include <set>
+#include <string>
+
+namespace clang {
+    class MacroDirective;
+    class Preprocessor;
+}
+
+namespace caide {
+namespace internal {
+
+// Makes the preprocessor skip the contents of system headers: a system header is entered
+// (so that inclusion callbacks are called as usual), but lexing stops right away.
+//
+// The result of preprocessing is the same as with full system headers unless user code
+// depends on macros defined in them. Conditions of user #if/#ifdef/#ifndef/#elif directives
+// are checked for macros that are undefined at that point, may be defined by a system header
+// (names reserved for the implementation and standard macros such as INT_MAX or EOF, but not
+// e.g. LOCAL or ONLINE_JUDGE), and are not include guards of user headers. If there are any,
+// dependsOnSystemMacros() returns true, and the caller must preprocess the code again without
+// this callback.
+//
+// An include guard is recognized by its whole pattern: the file starts with #ifndef X,
+// immediately followed by #define X with an empty body, and ends with the matching #endif.
+// A macro that user code merely defines after checking it (e.g. #ifndef INT_MAX, then
+// #define INT_MAX) still depends on system headers.
+class OpaqueSystemHeaders: public clang::PPCallbacks {
+public:
+    explicit OpaqueSystemHeaders(clang::Preprocessor& preprocessor);
+
+    bool dependsOnSystemMacros() const;
+
+    void FileChanged(clang::SourceLocation Loc, FileChangeReason Reason,
+                     clang::SrcMgr::CharacteristicKind FileType,
+                     clang::FileID PrevFID) override;
+
+    void MacroDefined(const clang::Token& MacroNameTok, const clang::MacroDirective* MD) override;
+
+    void If(clang::SourceLocation Loc, clang::SourceRange ConditionRange, ConditionValueKind ConditionValue) override;
+#if CAIDE_CLANG_VERSION_AT_LEAST(3,7)
+    void Ifdef(clang::SourceLocation Loc, const clang::Token& MacroNameTok, const clang::MacroDefinition& /*MD*/) override;
+    void Ifndef(clang::SourceLocation Loc, const clang::Token& MacroNameTok, const clang::MacroDefinition& /*MD*/) override;
+#else
+    void Ifdef(clang::SourceLocation Loc, const clang::Token& MacroNameTok, const clang::MacroDirective* /*MD*/) override;
+    void Ifndef(clang::SourceLocation Loc, const clang::Token& MacroNameTok, const clang::MacroDirective* /*MD*/) override;
+#endif
+    void Elif(clang::SourceLocation Loc, clang::SourceRange ConditionRange, ConditionValueKind ConditionValue, clang::SourceLocation /*IfLoc*/ ) override;
+    void Endif(clang::SourceLocation Loc, clang::SourceLocation IfLoc) override;
+
+private:
+    clang::Preprocessor& preprocessor;
+    bool systemHeaderSkipped;
+    // Condition refers to a macro that can't be checked (a function-like macro)
+    bool unknownMacroUsed;
+    // Possible system macros that were undefined when a condition referred to them
+    std::set<std::string> undefinedMacros;
+    // The last #ifndef at the start of a user file, if it hasn't been followed by another
+    // #define yet: the location of the directive and of its macro name
+    clang::SourceLocation guardIfndefLoc;
+    clang::SourceLocation guardNameLoc;
+    // Locations of #ifndef directives that may start an include guard, and their macros.
+    // The guard is confirmed by the matching #endif.
+    std::map<unsigned, std::string> guardCandidates;
+
+    bool isUserCodeAfterSkippedHeader(clang::SourceLocation loc) const;
+    clang::StringRef getFileText(clang::SourceLocation begin, clang::SourceLocation end) const;
+    void checkMacroName(const clang::Token& macroNameTok);
+    void checkCondition(clang::SourceRange conditionRange);
+    void checkIdentifier(const std::string& name, std::set<std::string>& visitedMacros);
+};
+
+}
+}
+
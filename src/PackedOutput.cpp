@@ -0,0 +1,182 @@
+//                        Caide C++ inliner
+//
+// This file is distributed under the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version. See LICENSE.TXT for details.
+
+#include "caidePackedOutput.hpp"
+#include "MappedFile.h"
+#include "hash.h"
+
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+
+using std::string;
+using std::uint64_t;
+
+
+namespace caide {
+
+static_assert(sizeof(PackedOutputEntry) == 48, "Unexpected layout of PackedOutputEntry");
+
+static const char indexMagic[8] = {'C', 'A', 'I', 'D', 'E', 'P', 'K', '1'};
+
+static uint64_t getFileSize(const string& filePath) {
+    std::ifstream in{filePath, std::ios::binary | std::ios::ate};
+    if (!in)
+        return 0;
+    return static_cast<uint64_t>(in.tellg());
+}
+
+PackedOutputWriter::PackedOutputWriter(const string& containerPath, std::size_t bufferSize_)
+    : dataPath{containerPath + ".data"}
+    , indexPath{containerPath + ".index"}
+    , bufferSize{bufferSize_}
+    , dataSize{getFileSize(dataPath)}
+    , pendingDataWritten{0}
+{
+    // Offsets are computed from the size of the data file rather than from the index:
+    // the data written by an interrupted writer is simply skipped.
+    {
+        std::ofstream data{dataPath, std::ios::binary | std::ios::app};
+        if (!data)
+            throw std::runtime_error("Couldn't create " + dataPath);
+    }
+    if (getFileSize(indexPath) == 0) {
+        std::ofstream index{indexPath, std::ios::binary | std::ios::app};
+        index.write(indexMagic, sizeof(indexMagic));
+        if (!index)
+            throw std::runtime_error("Couldn't create " + indexPath);
+    }
+}
+
+PackedOutputWriter::~PackedOutputWriter() {
+    try {
+        flush();
+    } catch (...) {
+    }
+}
+
+void PackedOutputWriter::append(uint64_t jobId, const string& content, int status,
+                                uint64_t elapsedMicroseconds)
+{
+    PackedOutputEntry entry;
+    entry.jobId = jobId;
+    entry.offset = dataSize;
+    entry.length = content.size();
+    entry.status = status;
+    entry.reserved = 0;
+    entry.elapsedMicroseconds = elapsedMicroseconds;
+    entry.contentHash = internal::fnv1aHash(content);
+
+    pendingData += content;
+    pendingEntries.push_back(entry);
+    dataSize += content.size();
+
+    if (pendingData.size() >= bufferSize)
+        flush();
+}
+
+void PackedOutputWriter::flush() {
+    if (pendingEntries.empty())
+        return;
+
+    if (pendingDataWritten < pendingData.size()) {
+        // A failed write may have appended a part of the data. The rest of the data
+        // goes after it, and the entries that refer to it are moved accordingly.
+        const uint64_t expectedSize = dataSize - (pendingData.size() - pendingDataWritten);
+        const uint64_t actualSize = getFileSize(dataPath);
+        if (actualSize != expectedSize) {
+            for (PackedOutputEntry& entry : pendingEntries) {
+                if (entry.offset >= expectedSize)
+                    entry.offset += actualSize - expectedSize;
+            }
+            dataSize += actualSize - expectedSize;
+        }
+
+        std::ofstream data{dataPath, std::ios::binary | std::ios::app};
+        data.write(pendingData.data() + pendingDataWritten, pendingData.size() - pendingDataWritten);
+        // Errors of buffered writes are detected only when the buffer is written out
+        data.close();
+        if (!data)
+            throw std::runtime_error("Couldn't write to " + dataPath);
+        // Not written again if writing the index fails
+        pendingDataWritten = pendingData.size();
+    }
+
+    {
+        std::ofstream index{indexPath, std::ios::binary | std::ios::app};
+        index.write(reinterpret_cast<const char*>(pendingEntries.data()),
+                    pendingEntries.size() * sizeof(PackedOutputEntry));
+        index.close();
+        if (!index)
+            throw std::runtime_error("Couldn't write to " + indexPath);
+    }
+
+    pendingData.clear();
+    pendingDataWritten = 0;
+    pendingEntries.clear();
+}
+
+
+PackedOutputReader::PackedOutputReader(const string& containerPath)
+    : indexFile{new internal::MappedFile{containerPath + ".index"}}
+    , dataFile{new internal::MappedFile{containerPath + ".data"}}
+    , entries{nullptr}
+    , numEntries{0}
+{
+    if (indexFile->size() < sizeof(indexMagic) ||
+            std::memcmp(indexFile->begin(), indexMagic, sizeof(indexMagic)) != 0)
+        throw std::runtime_error("Not a packed output container: " + containerPath);
+
+    // mmap'ed memory is page aligned, so the records are properly aligned too.
+    entries = reinterpret_cast<const PackedOutputEntry*>(indexFile->begin() + sizeof(indexMagic));
+    numEntries = (indexFile->size() - sizeof(indexMagic)) / sizeof(PackedOutputEntry);
+
+    // Ignore the index records written after the reader's view of the data file was taken.
+    while (numEntries > 0 && !isInDataFile(entries[numEntries-1]))
+        --numEntries;
+}
+
+bool PackedOutputReader::isInDataFile(const PackedOutputEntry& entry) const {
+    const uint64_t size = dataFile->size();
+    return entry.offset <= size && entry.length <= size - entry.offset;
+}
+
+PackedOutputReader::~PackedOutputReader() = default;
+
+std::size_t PackedOutputReader::size() const {
+    return numEntries;
+}
+
+const PackedOutputEntry& PackedOutputReader::entry(std::size_t i) const {
+    if (i >= numEntries)
+        throw std::out_of_range("Packed output entry index is out of range");
+    // A record in the middle of the index may be damaged too
+    if (!isInDataFile(entries[i]))
+        throw std::runtime_error("Packed output entry refers to data outside of the data file");
+    return entries[i];
+}
+
+const char* PackedOutputReader::data(std::size_t i) const {
+    return dataFile->begin() + entry(i).offset;
+}
+
+string PackedOutputReader::content(std::size_t i) const {
+    return string(data(i), entry(i).length);
+}
+
+std::size_t PackedOutputReader::find(uint64_t jobId) const {
+    for (std::size_t i = numEntries; i > 0; --i) {
+        if (entries[i-1].jobId == jobId)
+            return i-1;
+    }
+    return npos;
+}
+
+} // namespace caide
+
@@ -0,0 +1,311 @@
+//                        Caide C++ inliner
+//
+// This file is distributed under the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version. See LICENSE.TXT for details.
+
+#include "PreprocessorScanner.h"
+
+#include <cctype>
+
+
+using std::size_t;
+using std::string;
+using std::vector;
+
+namespace caide {
+namespace internal {
+
+static bool isIdentifierChar(char c) {
+    return std::isalnum(static_cast<unsigned char>(c)) || c == '_';
+}
+
+static bool isHorizontalSpace(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\f' || c == '\v';
+}
+
+namespace {
+
+class DirectiveScanner {
+public:
+    explicit DirectiveScanner(const string& text_)
+        : text(text_)
+        , n(text_.size())
+    {}
+
+    vector<PreprocessorDirective> scan() {
+        vector<PreprocessorDirective> directives;
+        bool atLineStart = true;
+        while (pos < n) {
+            const char c = text[pos];
+            if (c == '\n') {
+                ++line;
+                ++pos;
+                atLineStart = true;
+            } else if (isHorizontalSpace(c)) {
+                ++pos;
+            } else if (skipLineContinuation()) {
+            } else if (startsWith("//")) {
+                skipLineComment();
+            } else if (startsWith("/*")) {
+                skipBlockComment();
+            } else if (c == '#' && atLineStart) {
+                directives.push_back(readDirective());
+            } else if (startsWith("_Pragma") && getTokenStart() == pos &&
+                       (pos + 7 == n || !isIdentifierChar(text[pos + 7]))) {
+                atLineStart = false;
+                PreprocessorDirective directive;
+                if (readPragmaOperator(directive))
+                    directives.push_back(directive);
+            } else {
+                atLineStart = false;
+                if (c == '"' || c == '\'')
+                    skipLiteral();
+                else
+                    ++pos;
+            }
+        }
+        return directives;
+    }
+
+private:
+    const string& text;
+    const size_t n;
+    size_t pos = 0;
+    size_t line = 1;
+
+    bool startsWith(const char* s) const {
+        return text.compare(pos, string(s).size(), s) == 0;
+    }
+
+    bool skipLineContinuation() {
+        if (text[pos] != '\\')
+            return false;
+        size_t next = pos + 1;
+        if (next < n && text[next] == '\r')
+            ++next;
+        if (next < n && text[next] == '\n') {
+            pos = next + 1;
+            ++line;
+            return true;
+        }
+        return false;
+    }
+
+    // Stops at the line break
+    void skipLineComment() {
+        while (pos < n && text[pos] != '\n') {
+            if (!skipLineContinuation())
+                ++pos;
+        }
+    }
+
+    void skipBlockComment() {
+        pos += 2;
+        while (pos < n && !startsWith("*/")) {
+            if (text[pos] == '\n')
+                ++line;
+            ++pos;
+        }
+        pos = pos < n ? pos + 2 : n;
+    }
+
+    // Start of the identifier or pp-number ending right before pos
+    size_t getTokenStart() const {
+        size_t start = pos;
+        while (start > 0 && (isIdentifierChar(text[start-1]) || text[start-1] == '.'))
+            --start;
+        return start;
+    }
+
+    void skipLiteral() {
+        const char quote = text[pos];
+        const size_t prefixStart = getTokenStart();
+        const string prefix = text.substr(prefixStart, pos - prefixStart);
+
+        // Digit separator (C++14)
+        if (quote == '\'' && !prefix.empty() &&
+                std::isdigit(static_cast<unsigned char>(prefix[0]))) {
+            ++pos;
+            return;
+        }
+
+        if (quote == '"' && (prefix == "R" || prefix == "LR" || prefix == "uR" ||
+                             prefix == "UR" || prefix == "u8R")) {
+            skipRawStringLiteral();
+            return;
+        }
+
+        ++pos;
+        while (pos < n && text[pos] != quote && text[pos] != '\n') {
+            if (text[pos] == '\\' && pos + 1 < n) {
+                if (text[pos+1] == '\n')
+                    ++line;
+                ++pos;
+            }
+            ++pos;
+        }
+        if (pos < n && text[pos] == quote)
+            ++pos;
+    }
+
+    void skipRawStringLiteral() {
+        const size_t delimiterEnd = text.find('(', pos);
+        if (delimiterEnd == string::npos) {
+            ++pos;
+            return;
+        }
+        const string terminator = ")" + text.substr(pos + 1, delimiterEnd - pos - 1) + "\"";
+        size_t end = text.find(terminator, delimiterEnd);
+        end = end == string::npos ? n : end + terminator.size();
+        for (; pos < end; ++pos) {
+            if (text[pos] == '\n')
+                ++line;
+        }
+    }
+
+    // Skips whitespace and comments between tokens
+    void skipSpace() {
+        while (pos < n) {
+            if (text[pos] == '\n') {
+                ++line;
+                ++pos;
+            } else if (isHorizontalSpace(text[pos])) {
+                ++pos;
+            } else if (skipLineContinuation()) {
+            } else if (startsWith("//")) {
+                skipLineComment();
+            } else if (startsWith("/*")) {
+                skipBlockComment();
+            } else {
+                break;
+            }
+        }
+    }
+
+    // Reads _Pragma("...") as if it were #pragma ...
+    // If the operator is malformed, skips only the _Pragma keyword and returns false.
+    bool readPragmaOperator(PreprocessorDirective& directive) {
+        directive.offset = pos;
+        directive.line = line;
+        const size_t keywordEnd = pos + 7;
+        const size_t keywordLine = line;
+
+        pos = keywordEnd;
+        skipSpace();
+        if (pos < n && text[pos] == '(') {
+            ++pos;
+            skipSpace();
+            if (pos < n && (text[pos] == '"' || startsWith("L\""))) {
+                if (text[pos] == 'L')
+                    ++pos;
+                const size_t literalStart = pos;
+                skipLiteral();
+                const size_t literalEnd = pos;
+                skipSpace();
+                if (pos < n && text[pos] == ')' && literalEnd - literalStart >= 2 &&
+                        text[literalEnd - 1] == '"') {
+                    ++pos;
+                    directive.length = pos - directive.offset;
+                    directive.name = "pragma";
+                    // Destringize: \" becomes " and \\ becomes \ (C++11 [cpp.pragma.op])
+                    for (size_t i = literalStart + 1; i + 1 < literalEnd; ++i) {
+                        if (text[i] == '\\' && (text[i+1] == '"' || text[i+1] == '\\'))
+                            ++i;
+                        directive.arguments.push_back(text[i]);
+                    }
+                    return true;
+                }
+            }
+        }
+
+        pos = keywordEnd;
+        line = keywordLine;
+        return false;
+    }
+
+    // Reads the logical line starting with '#'. Stops at the line break.
+    PreprocessorDirective readDirective() {
+        PreprocessorDirective directive;
+        directive.offset = pos;
+        directive.line = line;
+
+        string body;
+        ++pos;
+        while (pos < n && text[pos] != '\n') {
+            if (skipLineContinuation())
+                continue;
+            if (startsWith("//")) {
+                skipLineComment();
+            } else if (startsWith("/*")) {
+                skipBlockComment();
+                body.push_back(' ');
+            } else if (text[pos] == '"' || text[pos] == '\'') {
+                const size_t start = pos;
+                skipLiteral();
+                body.append(text, start, pos - start);
+            } else {
+                body.push_back(text[pos]);
+                ++pos;
+            }
+        }
+        directive.length = pos - directive.offset;
+
+        size_t i = 0;
+        while (i < body.size() && isHorizontalSpace(body[i]))
+            ++i;
+        const size_t nameStart = i;
+        while (i < body.size() && isIdentifierChar(body[i]))
+            ++i;
+        directive.name = body.substr(nameStart, i - nameStart);
+        while (i < body.size() && isHorizontalSpace(body[i]))
+            ++i;
+        size_t argumentsEnd = body.size();
+        while (argumentsEnd > i && isHorizontalSpace(body[argumentsEnd-1]))
+            --argumentsEnd;
+        directive.arguments = body.substr(i, argumentsEnd - i);
+
+        return directive;
+    }
+};
+
+}
+
+vector<PreprocessorDirective> scanDirectives(const string& text) {
+    return DirectiveScanner(text).scan();
+}
+
+bool isInclusionDirective(const PreprocessorDirective& directive) {
+    return directive.name == "include" || directive.name == "include_next" ||
+           directive.name == "import";
+}
+
+IncludeForm getIncludeForm(const PreprocessorDirective& directive) {
+    if (!directive.arguments.empty() && directive.arguments[0] == '"')
+        return IncludeForm::Quoted;
+    if (!directive.arguments.empty() && directive.arguments[0] == '<')
+        return IncludeForm::Angled;
+    return IncludeForm::Computed;
+}
+
+string getIncludedFileName(const PreprocessorDirective& directive) {
+    const IncludeForm form = getIncludeForm(directive);
+    if (form == IncludeForm::Computed)
+        return "";
+    const size_t end = directive.arguments.find(form == IncludeForm::Quoted ? '"' : '>', 1);
+    if (end == string::npos)
+        return "";
+    return directive.arguments.substr(1, end - 1);
+}
+
+bool isPragmaOnce(const PreprocessorDirective& directive) {
+    if (directive.name != "pragma")
+        return false;
+    const string& args = directive.arguments;
+    return args.compare(0, 4, "once") == 0 &&
+           (args.size() == 4 || !isIdentifierChar(args[4]));
+}
+
+}
+}
+
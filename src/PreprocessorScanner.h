@@ -0,0 +1,59 @@
+//                        Caide C++ inliner
+//
+// This file is distributed under the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version. See LICENSE.TXT for details.
+
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace caide {
+namespace internal {
+
+// A preprocessor directive found by scanDirectives()
+struct PreprocessorDirective {
+    // Directive name, e.g. "include" or "ifdef"
+    std::string name;
+    // The rest of the directive with comments and line continuations removed
+    std::string arguments;
+    // Offset of '#' (or of the _Pragma keyword) in the scanned text
+    std::size_t offset;
+    // Length of the directive in the scanned text, up to the line break that ends it
+    // (or up to the closing parenthesis of _Pragma)
+    std::size_t length;
+    // 1-based line of '#' (or of the _Pragma keyword)
+    std::size_t line;
+};
+
+// Finds preprocessor directives without running the preprocessor: no files are included
+// and no conditions are evaluated, so directives in inactive blocks are returned too.
+// Comments and string literals are taken into account.
+// A _Pragma("...") operator outside of directives is returned as a `pragma` directive with
+// the destringized argument; _Pragma in macro definitions is not expanded.
+std::vector<PreprocessorDirective> scanDirectives(const std::string& text);
+
+enum class IncludeForm {
+    // #include "file"
+    Quoted,
+    // #include <file>
+    Angled,
+    // #include MACRO
+    Computed,
+};
+
+// Whether the directive includes a file (#include, #include_next or #import)
+bool isInclusionDirective(const PreprocessorDirective& directive);
+
+IncludeForm getIncludeForm(const PreprocessorDirective& directive);
+
+// Name of the included file, without quotes or angle brackets. Empty for computed includes.
+std::string getIncludedFileName(const PreprocessorDirective& directive);
+
+bool isPragmaOnce(const PreprocessorDirective& directive);
+
+}
+}
+
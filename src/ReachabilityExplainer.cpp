@@ -0,0 +1,287 @@
+//                        Caide C++ inliner
+//
+// This file is distributed under the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version. See LICENSE.TXT for details.
+
+#include "ReachabilityExplainer.h"
+#include "SourceInfo.h"
+#include "util.h"
+
+#include <clang/AST/ASTContext.h>
+#include <clang/AST/Decl.h>
+#include <clang/Basic/SourceManager.h>
+#include <clang/Lex/Lexer.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <sstream>
+#include <string>
+#include <utility>
+
+
+using namespace clang;
+using std::size_t;
+using std::string;
+using std::vector;
+
+namespace caide {
+namespace internal {
+
+ReachabilityExplainer::ReachabilityExplainer(ASTContext& ctx_, const SourceInfo& srcInfo_,
+        const std::unordered_set<Decl*>& used_,
+        const std::unordered_map<Decl*, Decl*>& reachedFrom_)
+    : ctx(ctx_)
+    , sourceManager(ctx_.getSourceManager())
+    , srcInfo(srcInfo_)
+    , used(used_)
+    , reachedFrom(reachedFrom_)
+{}
+
+string ReachabilityExplainer::explain(const vector<string>& queries) const {
+    std::ostringstream out;
+    for (const string& query : queries) {
+        vector<Decl*> decls = findDecls(query);
+        if (decls.empty()) {
+            out << "No declaration matches '" << query << "'\n\n";
+            continue;
+        }
+        for (Decl* decl : decls) {
+            explainDecl(out, decl);
+            out << "\n";
+        }
+    }
+
+    printRetainedSizes(out, 20);
+    return out.str();
+}
+
+vector<Decl*> ReachabilityExplainer::findDecls(const string& query) const {
+    // file:line or name?
+    const size_t colon = query.rfind(':');
+    const bool isLocation = colon != string::npos && colon + 1 < query.size() &&
+        query.find_first_not_of("0123456789", colon + 1) == string::npos;
+    const string fileName = isLocation ? query.substr(0, colon) : "";
+    const unsigned line = isLocation ? std::strtoul(query.c_str() + colon + 1, nullptr, 10) : 0;
+
+    auto matches = [&](Decl* decl) {
+        if (isLocation) {
+            SourceLocation start = getExpansionStart(sourceManager, decl);
+            if (start.isInvalid() || sourceManager.getExpansionLineNumber(start) != line)
+                return false;
+            StringRef declFile = sourceManager.getFilename(start);
+            return declFile.endswith(fileName);
+        }
+        const auto* namedDecl = dyn_cast<NamedDecl>(decl);
+        return namedDecl && (namedDecl->getNameAsString() == query ||
+                             namedDecl->getQualifiedNameAsString() == query);
+    };
+
+    std::unordered_set<Decl*> found;
+    for (Decl* decl : used) {
+        if (matches(decl))
+            found.insert(decl);
+    }
+    // Declarations that are not kept
+    for (const auto& kv : srcInfo.nonImplicitDecls) {
+        if (matches(kv.second))
+            found.insert(kv.second->getCanonicalDecl());
+    }
+
+    vector<Decl*> res(found.begin(), found.end());
+    std::sort(res.begin(), res.end(), [&](Decl* lhs, Decl* rhs) {
+        return sourceManager.isBeforeInTranslationUnit(lhs->getLocStart(), rhs->getLocStart());
+    });
+    return res;
+}
+
+string ReachabilityExplainer::describe(Decl* decl) const {
+    string res = decl->getDeclKindName();
+    if (const auto* namedDecl = dyn_cast<NamedDecl>(decl))
+        res += " " + namedDecl->getQualifiedNameAsString();
+    res += " <" + toString(sourceManager, getExpansionStart(sourceManager, decl)) + ">";
+    return res;
+}
+
+void ReachabilityExplainer::explainDecl(std::ostream& out, Decl* decl) const {
+    if (used.count(decl) == 0) {
+        out << describe(decl) << " is not kept\n";
+        return;
+    }
+
+    vector<Decl*> chain;
+    for (Decl* cur = decl; cur; ) {
+        chain.push_back(cur);
+        auto it = reachedFrom.find(cur);
+        cur = it == reachedFrom.end() ? nullptr : it->second;
+    }
+    std::reverse(chain.begin(), chain.end());
+
+    out << describe(decl) << " is kept because\n";
+    out << "  " << describe(chain[0]) << " is a root\n";
+    for (size_t i = 1; i < chain.size(); ++i) {
+        auto it = srcInfo.dependencyKinds.find(std::make_pair(chain[i-1], chain[i]));
+        const char* kind = it == srcInfo.dependencyKinds.end() ? "uses" : toString(it->second);
+        out << "  " << kind << " " << describe(chain[i]) << "\n";
+    }
+}
+
+void ReachabilityExplainer::printRetainedSizes(std::ostream& out, size_t count) const {
+    // Nodes of the reachability graph. Node 0 is a virtual root that uses all roots.
+    vector<Decl*> nodes(1, nullptr);
+    std::unordered_map<Decl*, int> nodeIndex;
+    for (Decl* decl : used) {
+        nodeIndex[decl] = static_cast<int>(nodes.size());
+        nodes.push_back(decl);
+    }
+    const int n = static_cast<int>(nodes.size());
+
+    vector<vector<int>> successors(n), predecessors(n);
+    auto addEdge = [&](int from, int to) {
+        successors[from].push_back(to);
+        predecessors[to].push_back(from);
+    };
+    for (Decl* root : srcInfo.declsToKeep) {
+        auto it = nodeIndex.find(root->getCanonicalDecl());
+        if (it != nodeIndex.end())
+            addEdge(0, it->second);
+    }
+    for (int v = 1; v < n; ++v) {
+        auto it = srcInfo.uses.find(nodes[v]);
+        if (it == srcInfo.uses.end())
+            continue;
+        for (Decl* to : it->second) {
+            auto jt = nodeIndex.find(to);
+            if (jt != nodeIndex.end())
+                addEdge(v, jt->second);
+        }
+    }
+
+    // Post-order numbering
+    vector<int> postOrder;
+    vector<int> postNumber(n, -1);
+    {
+        vector<char> visited(n, 0);
+        vector<std::pair<int, size_t>> stack;
+        stack.emplace_back(0, 0);
+        visited[0] = 1;
+        while (!stack.empty()) {
+            int v = stack.back().first;
+            size_t& nextChild = stack.back().second;
+            if (nextChild < successors[v].size()) {
+                int child = successors[v][nextChild++];
+                if (!visited[child]) {
+                    visited[child] = 1;
+                    stack.emplace_back(child, 0);
+                }
+            } else {
+                postNumber[v] = static_cast<int>(postOrder.size());
+                postOrder.push_back(v);
+                stack.pop_back();
+            }
+        }
+    }
+
+    // Immediate dominators (Cooper, Harvey, Kennedy. A Simple, Fast Dominance Algorithm).
+    vector<int> idom(n, -1);
+    idom[0] = 0;
+    auto intersect = [&](int a, int b) {
+        while (a != b) {
+            while (postNumber[a] < postNumber[b])
+                a = idom[a];
+            while (postNumber[b] < postNumber[a])
+                b = idom[b];
+        }
+        return a;
+    };
+    for (bool changed = true; changed; ) {
+        changed = false;
+        for (auto it = postOrder.rbegin(); it != postOrder.rend(); ++it) {
+            int v = *it;
+            if (v == 0)
+                continue;
+            int newIdom = -1;
+            for (int p : predecessors[v]) {
+                if (idom[p] != -1)
+                    newIdom = newIdom == -1 ? p : intersect(p, newIdom);
+            }
+            if (newIdom != idom[v]) {
+                idom[v] = newIdom;
+                changed = true;
+            }
+        }
+    }
+
+    // Source ranges of main file declarations, as offsets in the main file
+    typedef std::pair<unsigned, unsigned> Interval;
+    vector<Interval> intervals(n, Interval(0, 0));
+    vector<int> withInterval;
+    for (int v = 1; v < n; ++v) {
+        SourceRange range = getExpansionRange(sourceManager, nodes[v]);
+        if (range.isInvalid() || !sourceManager.isInMainFile(range.getBegin()) ||
+                !sourceManager.isInMainFile(range.getEnd()))
+            continue;
+        SourceLocation end = Lexer::getLocForEndOfToken(range.getEnd(), 0, sourceManager,
+            ctx.getLangOpts());
+        if (end.isInvalid())
+            end = range.getEnd();
+        unsigned b = sourceManager.getFileOffset(range.getBegin());
+        unsigned e = sourceManager.getFileOffset(end);
+        if (b < e) {
+            intervals[v] = Interval(b, e);
+            withInterval.push_back(v);
+        }
+    }
+
+    // Own size of a declaration: the part of its source range that is not inside another
+    // kept declaration (e.g. a class without its member functions). Text of a nested
+    // declaration is kept as long as the nested declaration itself is, which in turn keeps
+    // the outer one; so it is attributed to the nested declaration only.
+    vector<unsigned> ownSize(n, 0);
+    std::sort(withInterval.begin(), withInterval.end(), [&](int lhs, int rhs) {
+        if (intervals[lhs].first != intervals[rhs].first)
+            return intervals[lhs].first < intervals[rhs].first;
+        return intervals[lhs].second > intervals[rhs].second;
+    });
+    {
+        // Enclosing declarations of the current one, innermost last
+        vector<int> enclosing;
+        for (int v : withInterval) {
+            ownSize[v] = intervals[v].second - intervals[v].first;
+            // Ranges that overlap without nesting (possible with macros) are counted twice
+            while (!enclosing.empty() && intervals[enclosing.back()].second < intervals[v].second)
+                enclosing.pop_back();
+            if (!enclosing.empty())
+                ownSize[enclosing.back()] -= ownSize[v];
+            enclosing.push_back(v);
+        }
+    }
+
+    // Retained size of a node is the sum of own sizes over its subtree in the dominator tree.
+    // The immediate dominator of a node is its ancestor in the depth-first search tree, so
+    // children of the dominator tree come before their parents in post-order.
+    vector<std::uint64_t> retained(ownSize.begin(), ownSize.end());
+    for (int v : postOrder) {
+        if (v != 0 && idom[v] >= 0)
+            retained[idom[v]] += retained[v];
+    }
+
+    vector<std::pair<std::uint64_t, int>> retainedSizes;
+    for (int v : withInterval)
+        retainedSizes.emplace_back(retained[v], v);
+
+    count = std::min(count, retainedSizes.size());
+    std::partial_sort(retainedSizes.begin(), retainedSizes.begin() + count, retainedSizes.end(),
+        [](const std::pair<std::uint64_t, int>& lhs, const std::pair<std::uint64_t, int>& rhs) {
+            return lhs.first > rhs.first;
+        });
+
+    out << "Kept declarations by retained size (bytes):\n";
+    for (size_t i = 0; i < count; ++i)
+        out << "  " << retainedSizes[i].first << "\t" << describe(nodes[retainedSizes[i].second]) << "\n";
+}
+
+}
+}
+
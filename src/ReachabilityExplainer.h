@@ -0,0 +1,64 @@
+//                        Caide C++ inliner
+//
+// This file is distributed under the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version. See LICENSE.TXT for details.
+
+#pragma once
+
+#include <cstddef>
+#include <iosfwd>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+
+namespace clang {
+    class ASTContext;
+    class Decl;
+    class SourceManager;
+}
+
+namespace caide {
+namespace internal {
+
+struct SourceInfo;
+
+// Explains why declarations are kept, based on the reachability analysis of the optimizer.
+class ReachabilityExplainer {
+public:
+    // reachedFrom: for each used declaration except the roots, the declaration through which
+    // it was first reached in breadth-first search from the roots. Together with
+    // srcInfo.dependencyKinds it describes a shortest path from a root to each used declaration.
+    ReachabilityExplainer(clang::ASTContext& ctx, const SourceInfo& srcInfo,
+                          const std::unordered_set<clang::Decl*>& used,
+                          const std::unordered_map<clang::Decl*, clang::Decl*>& reachedFrom);
+
+    // Each query is either a (possibly qualified) name of a declaration or file:line,
+    // where the line refers to the optimizer input. Returns a human-readable explanation
+    // for each query, followed by the ranking of used main file declarations by retained
+    // size (see printRetainedSizes).
+    std::string explain(const std::vector<std::string>& queries) const;
+
+private:
+    std::vector<clang::Decl*> findDecls(const std::string& query) const;
+    std::string describe(clang::Decl* decl) const;
+    void explainDecl(std::ostream& out, clang::Decl* decl) const;
+
+    // Retained size of a used declaration D is the size of main file code that is kept only
+    // because D is kept, i.e. the total length of source ranges of all declarations dominated
+    // by D in the reachability graph. Text of a nested declaration counts towards the nested
+    // declaration only. Computed in linear time after the dominator tree is built.
+    void printRetainedSizes(std::ostream& out, std::size_t count) const;
+
+    clang::ASTContext& ctx;
+    clang::SourceManager& sourceManager;
+    const SourceInfo& srcInfo;
+    const std::unordered_set<clang::Decl*>& used;
+    const std::unordered_map<clang::Decl*, clang::Decl*>& reachedFrom;
+};
+
+}
+}
+
@@ -9,8 +9,6 @@
 
 #include <clang/Basic/SourceManager.h>
 
-#include <stdexcept>
-
 using namespace clang;
 
 namespace caide {
@@ -20,7 +18,6 @@ SmartRewriter::SmartRewriter(SourceManager& srcManager, const LangOptions& langO
     : rewriter(srcManager, langOptions)
     , comparer(srcManager)
     , removed(comparer)
-    , changesApplied(false)
 {
 }
 
@@ -36,17 +33,20 @@ bool SmartRewriter::isPartOfRangeRemoved(const SourceRange& range) const {
     return removed.intersects(range.getBegin(), range.getEnd());
 }
 
-const RewriteBuffer* SmartRewriter::getRewriteBufferFor(FileID fileID) const {
-    return rewriter.getRewriteBufferFor(fileID);
-}
-
-void SmartRewriter::applyChanges() {
-    if (changesApplied)
-        throw std::logic_error("Rewriter changes have already been applied");
-    changesApplied = true;
+std::vector<std::pair<unsigned, unsigned>> SmartRewriter::getRemovedOffsets(FileID fileID) const {
+    std::vector<std::pair<unsigned, unsigned>> offsets;
+    const SourceManager& sourceManager = rewriter.getSourceMgr();
     Rewriter::RewriteOptions opts;
-    for (const auto& range : removed)
-        rewriter.RemoveText(SourceRange(range.first, range.second), opts);
+    for (const auto& range : removed) {
+        // The end of the range is the start of its last token
+        const int size = rewriter.getRangeSize(SourceRange(range.first, range.second), opts);
+        if (size < 0)
+            continue;
+        std::pair<FileID, unsigned> begin = sourceManager.getDecomposedLoc(range.first);
+        if (begin.first == fileID)
+            offsets.emplace_back(begin.second, begin.second + static_cast<unsigned>(size));
+    }
+    return offsets;
 }
 
 }
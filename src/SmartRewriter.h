@@ -11,6 +11,9 @@
 
 #include <clang/Rewrite/Core/Rewriter.h>
 
+#include <utility>
+#include <vector>
+
 namespace clang {
     class LangOptions;
     class SourceManager;
@@ -30,14 +33,15 @@ public:
     bool isPartOfRangeRemoved(const clang::SourceRange& range) const;
     void removeRange(clang::SourceLocation begin, clang::SourceLocation end);
     void removeRange(const clang::SourceRange& range);
-    const clang::RewriteBuffer* getRewriteBufferFor(clang::FileID fileID) const;
-    void applyChanges();
+
+    // Removed parts of the file as [begin, end) offsets, sorted by begin.
+    // Adjacent ranges may overlap. Ranges inside macro expansions are ignored.
+    std::vector<std::pair<unsigned, unsigned>> getRemovedOffsets(clang::FileID fileID) const;
 
 private:
     clang::Rewriter rewriter;
     SourceLocationComparer comparer;
     IntervalSet<clang::SourceLocation, SourceLocationComparer> removed;
-    bool changesApplied;
 };
 
 }
@@ -14,6 +14,19 @@ std::pair<clang::SourceLocation, clang::Decl::Kind> SourceInfo::makeKey(clang::D
     return std::make_pair(nonImplicitDecl->getLocation(), nonImplicitDecl->getKind());
 }
 
+const char* toString(DependencyKind kind) {
+    switch (kind) {
+        case DependencyKind::Reference: return "references";
+        case DependencyKind::Call:      return "calls";
+        case DependencyKind::Type:      return "uses type";
+        case DependencyKind::Context:   return "is declared in";
+        case DependencyKind::Member:    return "keeps member";
+        case DependencyKind::Template:  return "is instantiated from";
+        case DependencyKind::Concept:   return "keeps concept member";
+    }
+    return "uses";
+}
+
 }
 }
 
@@ -24,11 +24,39 @@ namespace clang {
 namespace caide {
 namespace internal {
 
+// Why a declaration uses another declaration.
+enum class DependencyKind {
+    // Refers to a variable, function, field etc. by name
+    Reference,
+    // Calls a function or a constructor
+    Call,
+    // Refers to a type
+    Type,
+    // Is declared in a class or a namespace
+    Context,
+    // Owns a member that must be kept together with it (destructor, virtual method,
+    // enumerator, local variable)
+    Member,
+    // Is an instantiation or a part of a template
+    Template,
+    // Owns a member marked with a 'caide concept' comment
+    Concept,
+};
+
+const char* toString(DependencyKind kind);
+
 // Contains dependency graph and other information shared between optimizer stages.
 struct SourceInfo {
     // key: Decl, value: what the key uses.
     std::map<clang::Decl*, std::set<clang::Decl*>> uses;
 
+    // Whether to fill dependencyKinds.
+    bool recordDependencyKinds = false;
+
+    // key: an edge of the dependency graph, value: the kind of the first dependency that
+    // created this edge.
+    std::map<std::pair<clang::Decl*, clang::Decl*>, DependencyKind> dependencyKinds;
+
     // 'Roots of the dependency graph':
     // - int main()
     // - declarations marked with a comment '/// caide keep'
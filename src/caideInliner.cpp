@@ -6,27 +6,58 @@
 
 #include "caideInliner.hpp"
 #include "caideInliner.h"
+#include "caide_probes.h"
 
+#include "CompileCostAnalyzer.h"
+#include "FrontendTool.h"
+#include "hash.h"
+#include "InlinedCodeCache.h"
 #include "inliner.h"
 #include "optimizer.h"
+#include "PreprocessorScanner.h"
 
 #include <algorithm>
-#include <limits>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
 #include <fstream>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <ostream>
+#include <set>
 #include <sstream>
 #include <stdexcept>
 #include <string>
+#include <thread>
+#include <utility>
 #include <vector>
 
 
 using std::istringstream;
 using std::ofstream;
+using std::set;
 using std::string;
 using std::vector;
 
 
 namespace caide {
 
+CompilationError::CompilationError(vector<CompilationDiagnostic> diagnostics)
+    : std::runtime_error("Compilation error")
+    , diagnostics_(std::move(diagnostics))
+{
+}
+
+const vector<CompilationDiagnostic>& CompilationError::diagnostics() const {
+    return diagnostics_;
+}
+
 static string trimEndPathSeparators(const string& path) {
     string result{path};
     auto lastSymbol = result.find_last_not_of("/\\");
@@ -39,19 +70,44 @@ CppInliner::CppInliner(const string& temporaryDirectory_)
     : clangCompilationOptions{}
     , macrosToKeep{"_WIN32", "_WIN64", "_MSC_VER", "__GNUC__", "__cplusplus"}
     , maxConsequentEmptyLines{2}
+    , errorLimit{1}
+    , dependencyGraphFile{}
+    , declarationsToExplain{}
+    , analyzeCompileCost{false}
+    , verifyOutput{false}
+    , removeUnusedCode{true}
+    , cacheInlinedCode{false}
+    , opaqueSystemHeaders{false}
+    , skipSystemFunctionBodies{false}
+    , lazyDependencyGraph{false}
+    , jobId{0}
+    , driverCacheFile{}
     , temporaryDirectory{trimEndPathSeparators(temporaryDirectory_)}
 {
 }
 
-static void concatFiles(const vector<string>& cppFilePaths, const string& outputFilePath) {
-    ofstream out{outputFilePath};
-    for (const string& filePath : cppFilePaths) {
+static vector<string> readFiles(const vector<string>& filePaths) {
+    vector<string> contents;
+    for (const string& filePath : filePaths) {
         std::ifstream in{filePath};
         if (!in)
             throw std::runtime_error(string("File not found: " + filePath));
-        out << in.rdbuf();
-        out << '\n'; // in case there was no return at end of file
+        std::ostringstream content;
+        content << in.rdbuf();
+        contents.push_back(content.str());
+    }
+    return contents;
+}
+
+static string concatFiles(const vector<string>& contents, const string& outputFilePath) {
+    string result;
+    for (const string& content : contents) {
+        result += content;
+        result += '\n'; // in case there was no return at end of file
     }
+    ofstream out{outputFilePath};
+    out << result;
+    return result;
 }
 
 static bool isPragmaOnce(string line) {
@@ -59,45 +115,109 @@ static bool isPragmaOnce(string line) {
                 [](char c) { return c == ' ' || c == '\t' || c == '\r'; });
     line.erase(it, line.end());
     // This is technically incorrect in view of multiline macros, multiline strings etc...
-    return line == "#pragmaonce";
+    return line == "#pragmaonce" || line == "_Pragma(\"once\")";
 }
 
-static void removePragmaOnce(const string& textInBinaryMode, const string& outputFilePath) {
+static string removePragmaOnce(const string& textInBinaryMode, const string& outputFilePath) {
     istringstream in{textInBinaryMode};
-    ofstream out{outputFilePath, std::ios::binary};
+    std::ostringstream result;
     string line;
     while (std::getline(in, line)) {
         if (!isPragmaOnce(line))
-            out << line << '\n';
+            result << line << '\n';
     }
+    ofstream out{outputFilePath, std::ios::binary};
+    out << result.str();
+    return result.str();
 }
 
-static bool isWhitespaceOnly(const string& text) {
-    return text.find_first_not_of(" \t\r") == string::npos;
+static void appendSpan(vector<TextSpan>& spans, std::size_t begin, std::size_t end) {
+    if (!spans.empty() && spans.back().end == begin)
+        spans.back().end = end;
+    else
+        spans.push_back(TextSpan{begin, end});
 }
 
-static void removeEmptyLines(const string& textInBinaryMode,
-                             int maxConsequentEmptyLines,
-                             const string& outputFilePath)
-{
+// Drops lines from the text described by spans, so that it doesn't start with
+// empty lines and has at most maxConsequentEmptyLines consecutive empty lines.
+// Every kept line ends with a line break.
+static void removeEmptyLines(KeptSpans& text, int maxConsequentEmptyLines) {
     if (maxConsequentEmptyLines < 0)
         maxConsequentEmptyLines = std::numeric_limits<int>::max();
-    istringstream in{textInBinaryMode};
-    ofstream out{outputFilePath, std::ios::binary};
+
+    vector<TextSpan> keptSpans;
     int currentConsequentEmptyLines = 0;
     bool readNonEmptyLine = false;
-    string line;
-    while (std::getline(in, line)) {
-        if (isWhitespaceOnly(line))
+
+    // Parts of the current line (a line may span several spans)
+    vector<TextSpan> line;
+    bool whitespaceOnly = true;
+
+    auto finishLine = [&](bool endsWithLineBreak) {
+        if (line.empty())
+            return;
+        if (whitespaceOnly)
             ++currentConsequentEmptyLines;
         else {
             currentConsequentEmptyLines = 0;
             readNonEmptyLine = true;
         }
 
-        if (readNonEmptyLine && currentConsequentEmptyLines <= maxConsequentEmptyLines)
-            out << line << '\n';
+        if (readNonEmptyLine && currentConsequentEmptyLines <= maxConsequentEmptyLines) {
+            for (const TextSpan& part : line)
+                appendSpan(keptSpans, part.begin, part.end);
+            if (!endsWithLineBreak)
+                text.suffix = "\n";
+        }
+        line.clear();
+        whitespaceOnly = true;
+    };
+
+    text.suffix.clear();
+    for (const TextSpan& span : text.spans) {
+        std::size_t partBegin = span.begin;
+        for (std::size_t i = span.begin; i < span.end; ++i) {
+            const char c = text.buffer[i];
+            if (c == '\n') {
+                line.push_back(TextSpan{partBegin, i + 1});
+                finishLine(true);
+                partBegin = i + 1;
+            } else if (c != ' ' && c != '\t' && c != '\r') {
+                whitespaceOnly = false;
+            }
+        }
+        if (partBegin < span.end)
+            line.push_back(TextSpan{partBegin, span.end});
     }
+    finishLine(false);
+
+    text.spans.swap(keptSpans);
+}
+
+void writeKeptSpans(const KeptSpans& output, std::ostream& out) {
+    for (const TextSpan& span : output.spans)
+        out.write(output.buffer.data() + span.begin, span.end - span.begin);
+    out << output.suffix;
+}
+
+static string materialize(const KeptSpans& text) {
+    std::ostringstream out;
+    writeKeptSpans(text, out);
+    return out.str();
+}
+
+static std::size_t getSize(const KeptSpans& text) {
+    std::size_t size = text.suffix.size();
+    for (const TextSpan& span : text.spans)
+        size += span.end - span.begin;
+    return size;
+}
+
+static std::size_t getSize(const vector<string>& contents) {
+    std::size_t size = 0;
+    for (const string& content : contents)
+        size += content.size();
+    return size;
 }
 
 static string pathConcat(const string& path, const string& fileName) {
@@ -107,19 +227,402 @@ static string pathConcat(const string& path, const string& fileName) {
     return result;
 }
 
-void CppInliner::inlineCode(const vector<string>& cppFilePaths, const string& outputFilePath) const {
-    const string concatStage{pathConcat(temporaryDirectory, "concat.cpp")};
-    const string inlinedStage{pathConcat(temporaryDirectory, "inlined.cpp")};
+InlinerResult CppInliner::inlineCode(const vector<string>& cppFilePaths,
+                                     const string& outputFilePath) const
+{
+    ofstream out{outputFilePath, std::ios::binary};
+    return inlineCode(cppFilePaths, out);
+}
+
+namespace {
+
+// Input files of a program and everything derived from them that doesn't depend
+// on compilation options
+struct ProgramSources {
+    vector<string> filePaths;
+    vector<string> contents;
+    vector<vector<internal::PreprocessorDirective>> directives;
+    // Concatenation of all C++ files; set by the `concat` stage
+    string concatenated;
+};
+
+// Stages that a job needs, decided by a raw scan of the input before any stage is run
+struct StagePlan {
+    bool concat;
+    bool inlineHeaders;
+    bool removePragmaOnce;
+    bool optimize;
+};
+
+// What distinguishes configurations of a program from one another
+struct Configuration {
+    vector<string> clangCompilationOptions;
+    // Prefix of the names of intermediate files of the configuration
+    string fileNamePrefix;
+    string dependencyGraphFile;
+    // Passed to tracing probes
+    std::uint64_t jobId;
+};
+
+}
+
+static ProgramSources readSources(const vector<string>& cppFilePaths) {
+    ProgramSources sources;
+    sources.filePaths = cppFilePaths;
+    sources.contents = readFiles(cppFilePaths);
+    for (const string& content : sources.contents)
+        sources.directives.push_back(internal::scanDirectives(content));
+    return sources;
+}
+
+// Options that change how includes are resolved or include files implicitly, e.g. -I,
+// -iquote, -isystem, -include, in separate, joined and `=` forms
+static bool hasIncludeOptions(const vector<string>& clangCompilationOptions) {
+    static const char* const prefixes[] = {
+        // -I, -iquote, -isystem, -idirafter, -include, -imacros, -iprefix, -iwithprefix,
+        // -isysroot, -iframework etc.
+        "-I", "-i",
+        // --include-directory, --include-directory-after, --include-prefix, --include-with-prefix,
+        // --imacros, --sysroot
+        "--include", "--imacros", "--sysroot", "-cxx-isystem", "-nostdinc", "-F",
+        // clang-cl
+        "/I", "/imsvc", "/FI",
+    };
+    for (const string& option : clangCompilationOptions) {
+        for (const char* prefix : prefixes) {
+            if (option.compare(0, std::strlen(prefix), prefix) == 0)
+                return true;
+        }
+    }
+    return false;
+}
 
-    concatFiles(cppFilePaths, concatStage);
+// Environment variables that add directories to the include path of clang
+static const char* const includePathVariables[] = {
+    "CPATH", "C_INCLUDE_PATH", "CPLUS_INCLUDE_PATH", "OBJC_INCLUDE_PATH", "OBJCPLUS_INCLUDE_PATH",
+};
 
-    internal::Inliner inliner{clangCompilationOptions};
-    std::string inlinedCode{inliner.doInline(concatStage)};
-    removePragmaOnce(inlinedCode, inlinedStage);
+static bool hasIncludePathVariables() {
+    for (const char* variable : includePathVariables) {
+        const char* value = std::getenv(variable);
+        if (value && *value)
+            return true;
+    }
+    return false;
+}
+
+static StagePlan planStages(const ProgramSources& sources,
+                            const vector<string>& clangCompilationOptions,
+                            bool removeUnusedCode)
+{
+    StagePlan plan;
+    plan.concat = sources.contents.size() != 1;
+    // With include options or include path variables, <header> may refer to a user header,
+    // and files may be included without an #include directive. Only the inline stage resolves
+    // them correctly.
+    plan.inlineHeaders = hasIncludeOptions(clangCompilationOptions) || hasIncludePathVariables();
+    plan.removePragmaOnce = false;
+    plan.optimize = removeUnusedCode;
 
-    internal::Optimizer optimizer{clangCompilationOptions, macrosToKeep};
-    std::string onlyReachableCode{optimizer.doOptimize(inlinedStage)};
-    removeEmptyLines(onlyReachableCode, maxConsequentEmptyLines, outputFilePath);
+    set<string> angledIncludes;
+    for (const auto& directives : sources.directives) {
+        for (const internal::PreprocessorDirective& directive : directives) {
+            if (internal::isPragmaOnce(directive)) {
+                plan.removePragmaOnce = true;
+            } else if (internal::isInclusionDirective(directive)) {
+                // Other than user headers, the inliner removes repeated includes of system headers
+                if (internal::getIncludeForm(directive) != internal::IncludeForm::Angled ||
+                        !angledIncludes.insert(internal::getIncludedFileName(directive)).second)
+                    plan.inlineHeaders = true;
+            }
+        }
+    }
+
+    if (plan.inlineHeaders) {
+        // Quoted includes are resolved relative to the temporary directory, as before
+        plan.concat = true;
+        // Inlined headers may contain #pragma once
+        plan.removePragmaOnce = true;
+    }
+
+    return plan;
+}
+
+// Everything the result of the inliner stage depends on, except headers
+static std::uint64_t getInlinedCodeCacheKey(const string& concatenatedCode,
+                                            const vector<string>& clangCompilationOptions)
+{
+    std::uint64_t key = internal::fnv1aHash(concatenatedCode);
+    for (const string& option : clangCompilationOptions) {
+        key = internal::fnv1aHash(option, key);
+        key = internal::fnv1aHash("", 1, key);
+    }
+    // Relative include directories are resolved against the current directory
+    key = internal::fnv1aHash(internal::getCurrentDirectory(), key);
+    key = internal::fnv1aHash("", 1, key);
+    for (const char* variable : includePathVariables) {
+        const char* value = std::getenv(variable);
+        key = internal::fnv1aHash(value ? string(variable) + "=" + value : string(variable), key);
+        key = internal::fnv1aHash("", 1, key);
+    }
+    return key;
+}
+
+// Writes new entries of the driver cache once all stages have run. If a stage has failed,
+// its error is reported rather than a failure to write the cache.
+static void saveDriverCache(const string& driverCacheFile, bool stageFailed) {
+    if (driverCacheFile.empty())
+        return;
+    try {
+        internal::saveDriverCache();
+    } catch (const std::exception&) {
+        if (!stageFailed)
+            throw;
+    }
+}
+
+// inputSize is the size of the program (in bytes) before the stage
+static void runStage(InlinerResult& result, std::uint64_t jobId, const char* name, bool execute,
+                     std::size_t inputSize, const std::function<void()>& stage)
+{
+    CAIDE_PROBE3(stage__start, jobId, name, inputSize);
+    const auto start = std::chrono::steady_clock::now();
+    if (execute)
+        stage();
+    StageStatistics stats;
+    stats.name = name;
+    stats.executed = execute;
+    stats.fromCache = false;
+    stats.elapsedMicroseconds = static_cast<std::uint64_t>(
+        std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start).count());
+    CAIDE_PROBE4(stage__end, jobId, name, execute, stats.elapsedMicroseconds);
+    result.stages.push_back(std::move(stats));
+}
+
+// Stages of inlineCode() that depend on the configuration
+static void runPipeline(const CppInliner& inliner, const string& temporaryDirectory,
+                        const ProgramSources& sources, const Configuration& configuration,
+                        const StagePlan& plan, InlinerResult& result, KeptSpans& output)
+{
+    const vector<string>& options = configuration.clangCompilationOptions;
+    const std::uint64_t jobId = configuration.jobId;
+    const string inlinedStage{pathConcat(temporaryDirectory,
+                                         configuration.fileNamePrefix + "inlined.cpp")};
+
+    // Current state of the program and the file that the next clang stage reads
+    string code;
+    string currentFile;
+    if (plan.concat) {
+        code = sources.concatenated;
+        currentFile = pathConcat(temporaryDirectory, "concat.cpp");
+    } else {
+        code = sources.contents[0];
+        currentFile = sources.filePaths[0];
+    }
+
+    bool inlinedCodeFromCache = false;
+    runStage(result, jobId, "inline", plan.inlineHeaders, code.size(), [&] {
+        internal::InlinedCodeCache cache{temporaryDirectory, configuration.fileNamePrefix};
+        const std::uint64_t cacheKey = getInlinedCodeCacheKey(code, options);
+        if (inliner.cacheInlinedCode && cache.lookup(cacheKey, code, result.diagnostics)) {
+            inlinedCodeFromCache = true;
+            return;
+        }
+
+        internal::Inliner headerInliner{options};
+        headerInliner.errorLimit = inliner.errorLimit;
+        headerInliner.buildSegmentMap = inliner.cacheInlinedCode;
+        headerInliner.opaqueSystemHeaders = inliner.opaqueSystemHeaders;
+        code = headerInliner.doInline(currentFile);
+        result.diagnostics = std::move(headerInliner.diagnostics);
+
+        if (inliner.cacheInlinedCode) {
+            cache.store(cacheKey, code, headerInliner.getIncludedHeaders(),
+                        headerInliner.getShadowingPaths(), headerInliner.getSegmentMap(),
+                        result.diagnostics);
+        }
+    });
+    result.stages.back().fromCache = inlinedCodeFromCache;
+
+    runStage(result, jobId, "removePragmaOnce", plan.removePragmaOnce, code.size(), [&] {
+        code = removePragmaOnce(code, inlinedStage);
+        currentFile = inlinedStage;
+    });
+
+    const bool verifyOutput = inliner.verifyOutput && plan.optimize;
+    std::unique_ptr<internal::Optimizer> optimizer{
+        new internal::Optimizer{options, inliner.macrosToKeep}};
+    runStage(result, jobId, "optimize", plan.optimize, code.size(), [&] {
+        // The optimizer reads currentFile; don't keep another copy of the program meanwhile
+        string().swap(code);
+        optimizer->errorLimit = inliner.errorLimit;
+        optimizer->skipSystemFunctionBodies = inliner.skipSystemFunctionBodies;
+        optimizer->lazyDependencyGraph = inliner.lazyDependencyGraph;
+        optimizer->jobId = jobId;
+        optimizer->dependencyGraphFile = configuration.dependencyGraphFile;
+        optimizer->declarationsToExplain = inliner.declarationsToExplain;
+        output = optimizer->doOptimize(currentFile);
+        result.diagnostics.insert(result.diagnostics.end(),
+            optimizer->diagnostics.begin(), optimizer->diagnostics.end());
+        result.explanation = std::move(optimizer->explanation);
+        result.traversedDeclarations = optimizer->traversedDeclarations;
+    });
+    // Clang state is needed only to verify the output
+    if (!verifyOutput)
+        optimizer.reset();
+    if (!plan.optimize) {
+        output.buffer = std::move(code);
+        output.spans.assign(1, TextSpan{0, output.buffer.size()});
+        output.suffix.clear();
+    }
+
+    runStage(result, jobId, "removeEmptyLines", true, getSize(output), [&] {
+        removeEmptyLines(output, inliner.maxConsequentEmptyLines);
+    });
+
+    runStage(result, jobId, "verify", verifyOutput, getSize(output), [&] {
+        result.verificationDiagnostics = optimizer->verify(materialize(output));
+    });
+
+    runStage(result, jobId, "compileCost", inliner.analyzeCompileCost, getSize(output), [&] {
+        const string outputStage{pathConcat(temporaryDirectory,
+                                            configuration.fileNamePrefix + "output.cpp")};
+        {
+            ofstream out{outputStage, std::ios::binary};
+            writeKeptSpans(output, out);
+        }
+        internal::CompileCostAnalyzer analyzer{options};
+        result.compileCostReport = analyzer.analyze(outputStage);
+    });
+}
+
+InlinerResult CppInliner::inlineCode(const vector<string>& cppFilePaths, std::ostream& output) const {
+    KeptSpans spans;
+    InlinerResult result = inlineCode(cppFilePaths, spans);
+    writeKeptSpans(spans, output);
+    return result;
+}
+
+InlinerResult CppInliner::inlineCode(const vector<string>& cppFilePaths, KeptSpans& output) const {
+    Configuration configuration;
+    configuration.clangCompilationOptions = clangCompilationOptions;
+    configuration.dependencyGraphFile = dependencyGraphFile;
+    configuration.jobId = jobId;
+    if (!driverCacheFile.empty())
+        internal::setDriverCacheFile(driverCacheFile);
+
+    InlinerResult result;
+    ProgramSources sources;
+    StagePlan plan;
+    runStage(result, jobId, "plan", true, 0, [&] {
+        sources = readSources(cppFilePaths);
+        plan = planStages(sources, clangCompilationOptions, removeUnusedCode);
+    });
+
+    runStage(result, jobId, "concat", plan.concat, getSize(sources.contents), [&] {
+        sources.concatenated = concatFiles(sources.contents,
+                                           pathConcat(temporaryDirectory, "concat.cpp"));
+    });
+
+    try {
+        runPipeline(*this, temporaryDirectory, sources, configuration, plan, result, output);
+    } catch (...) {
+        saveDriverCache(driverCacheFile, true);
+        throw;
+    }
+    saveDriverCache(driverCacheFile, false);
+    return result;
+}
+
+vector<VariantOutput> CppInliner::inlineCodeVariants(
+        const vector<string>& cppFilePaths,
+        const vector<vector<string>>& optionVariants) const
+{
+    vector<VariantOutput> outputs(optionVariants.size());
+    if (optionVariants.empty())
+        return outputs;
+
+    if (!driverCacheFile.empty())
+        internal::setDriverCacheFile(driverCacheFile);
+
+    InlinerResult sharedStages;
+    ProgramSources sources;
+    runStage(sharedStages, jobId, "plan", true, 0, [&] {
+        sources = readSources(cppFilePaths);
+    });
+
+    // Configurations with identical options are processed once
+    std::map<vector<string>, std::size_t> firstVariantWithOptions;
+    vector<std::size_t> distinctVariants;
+    vector<Configuration> configurations(optionVariants.size());
+    vector<StagePlan> plans(optionVariants.size());
+    bool concatNeeded = false;
+    for (std::size_t i = 0; i < optionVariants.size(); ++i) {
+        if (!firstVariantWithOptions.insert(std::make_pair(optionVariants[i], i)).second)
+            continue;
+        distinctVariants.push_back(i);
+
+        Configuration& configuration = configurations[i];
+        configuration.clangCompilationOptions = clangCompilationOptions;
+        configuration.clangCompilationOptions.insert(configuration.clangCompilationOptions.end(),
+            optionVariants[i].begin(), optionVariants[i].end());
+        configuration.fileNamePrefix = "variant" + std::to_string(i) + "-";
+        if (!dependencyGraphFile.empty())
+            configuration.dependencyGraphFile = dependencyGraphFile + "." + std::to_string(i);
+        configuration.jobId = jobId + i;
+
+        plans[i] = planStages(sources, configuration.clangCompilationOptions, removeUnusedCode);
+        concatNeeded = concatNeeded || plans[i].concat;
+    }
+
+    runStage(sharedStages, jobId, "concat", concatNeeded, getSize(sources.contents), [&] {
+        sources.concatenated = concatFiles(sources.contents,
+                                           pathConcat(temporaryDirectory, "concat.cpp"));
+    });
+
+    // Each worker takes the next unprocessed configuration until none are left
+    vector<std::exception_ptr> errors(optionVariants.size());
+    std::atomic<std::size_t> nextVariant{0};
+    auto worker = [&] {
+        for (std::size_t k = nextVariant++; k < distinctVariants.size(); k = nextVariant++) {
+            const std::size_t i = distinctVariants[k];
+            try {
+                outputs[i].result.stages = sharedStages.stages;
+                if (!plans[i].concat) {
+                    StageStatistics& concat = outputs[i].result.stages.back();
+                    concat.executed = false;
+                    concat.elapsedMicroseconds = 0;
+                }
+                runPipeline(*this, temporaryDirectory, sources, configurations[i], plans[i],
+                            outputs[i].result, outputs[i].output);
+            } catch (...) {
+                errors[i] = std::current_exception();
+            }
+        }
+    };
+
+    const std::size_t numWorkers = std::min<std::size_t>(distinctVariants.size(),
+        std::max(1u, std::thread::hardware_concurrency()));
+    vector<std::thread> workers;
+    for (std::size_t i = 1; i < numWorkers; ++i)
+        workers.emplace_back(worker);
+    worker();
+    for (std::thread& thread : workers)
+        thread.join();
+
+    saveDriverCache(driverCacheFile, std::any_of(errors.begin(), errors.end(),
+        [](const std::exception_ptr& error) { return static_cast<bool>(error); }));
+
+    for (std::size_t i = 0; i < optionVariants.size(); ++i) {
+        const std::size_t first = firstVariantWithOptions[optionVariants[i]];
+        if (errors[first])
+            std::rethrow_exception(errors[first]);
+        if (first != i)
+            outputs[i] = outputs[first];
+    }
+
+    return outputs;
 }
 
 } // namespace caide
@@ -131,21 +634,111 @@ static vector<string> arrayToCppVector(const char** array, int size) {
     return res;
 }
 
+static char* copyString(const string& s) {
+    char* res = static_cast<char*>(std::malloc(s.size() + 1));
+    if (res)
+        std::memcpy(res, s.c_str(), s.size() + 1);
+    return res;
+}
+
+static CaideDiagnosticSeverity toCSeverity(caide::CompilationDiagnostic::Severity severity) {
+    switch (severity) {
+        case caide::CompilationDiagnostic::Severity::Note:
+            return CAIDE_DIAGNOSTIC_NOTE;
+        case caide::CompilationDiagnostic::Severity::Warning:
+            return CAIDE_DIAGNOSTIC_WARNING;
+        case caide::CompilationDiagnostic::Severity::Error:
+            return CAIDE_DIAGNOSTIC_ERROR;
+        case caide::CompilationDiagnostic::Severity::Fatal:
+        default:
+            return CAIDE_DIAGNOSTIC_FATAL;
+    }
+}
+
+static void exportDiagnostics(const vector<caide::CompilationDiagnostic>& diagnostics,
+                              CaideDiagnostic** result, int* numResults)
+{
+    if (!result || !numResults)
+        return;
+    *result = nullptr;
+    *numResults = 0;
+    if (diagnostics.empty())
+        return;
+
+    *result = static_cast<CaideDiagnostic*>(std::calloc(diagnostics.size(), sizeof(CaideDiagnostic)));
+    if (!*result)
+        return;
+    *numResults = static_cast<int>(diagnostics.size());
+    for (size_t i = 0; i < diagnostics.size(); ++i) {
+        CaideDiagnostic& diagnostic = (*result)[i];
+        diagnostic.severity = toCSeverity(diagnostics[i].severity);
+        diagnostic.file = copyString(diagnostics[i].file);
+        diagnostic.line = static_cast<int>(diagnostics[i].line);
+        diagnostic.column = static_cast<int>(diagnostics[i].column);
+        diagnostic.message = copyString(diagnostics[i].message);
+    }
+}
+
+static const char* toString(CaideDiagnosticSeverity severity) {
+    switch (severity) {
+        case CAIDE_DIAGNOSTIC_NOTE:
+            return "note";
+        case CAIDE_DIAGNOSTIC_WARNING:
+            return "warning";
+        case CAIDE_DIAGNOSTIC_ERROR:
+            return "error";
+        case CAIDE_DIAGNOSTIC_FATAL:
+        default:
+            return "fatal error";
+    }
+}
+
 extern "C" int caideInlineCppCode(
         const CaideCppInlinerOptions* options,
         const char** cppFilePaths,
         int numCppFiles,
         const char* outputFilePath)
 {
+    // As before diagnostics were collected: no error limit of its own, and all diagnostics
+    // are printed to stderr
+    CaideDiagnostic* diagnostics = nullptr;
+    int numDiagnostics = 0;
+    const int ret = caideInlineCppCodeWithDiagnostics(options, 0, cppFilePaths, numCppFiles,
+                                                      outputFilePath, &diagnostics, &numDiagnostics);
+    for (int i = 0; i < numDiagnostics; ++i) {
+        const CaideDiagnostic& diagnostic = diagnostics[i];
+        if (diagnostic.file && *diagnostic.file)
+            std::cerr << diagnostic.file << ":" << diagnostic.line << ":" << diagnostic.column << ": ";
+        std::cerr << toString(diagnostic.severity) << ": " << diagnostic.message << "\n";
+    }
+    caideFreeDiagnostics(diagnostics, numDiagnostics);
+    return ret;
+}
+
+extern "C" int caideInlineCppCodeWithDiagnostics(
+        const CaideCppInlinerOptions* options,
+        int errorLimit,
+        const char** cppFilePaths,
+        int numCppFiles,
+        const char* outputFilePath,
+        CaideDiagnostic** diagnostics,
+        int* numDiagnostics)
+{
+    exportDiagnostics({}, diagnostics, numDiagnostics);
     try {
         caide::CppInliner inliner(options->temporaryDirectory);
         inliner.clangCompilationOptions = arrayToCppVector(
             options->clangCompilationOptions, options->numClangOptions);
         inliner.macrosToKeep = arrayToCppVector(options->macrosToKeep, options->numMacrosToKeep);
         inliner.maxConsequentEmptyLines = options->maxConsequentEmptyLines;
+        inliner.errorLimit = errorLimit;
         vector<string> files = arrayToCppVector(cppFilePaths, numCppFiles);
-        inliner.inlineCode(files, outputFilePath);
+        caide::InlinerResult result = inliner.inlineCode(files, outputFilePath);
+        exportDiagnostics(result.diagnostics, diagnostics, numDiagnostics);
         return 0;
+    } catch (const caide::CompilationError& e) {
+        exportDiagnostics(e.diagnostics(), diagnostics, numDiagnostics);
+        return 1;
     } catch (const std::exception& e) {
         return 1;
     } catch (...) {
@@ -153,3 +746,12 @@ extern "C" int caideInlineCppCode(
     }
 }
 
+extern "C" void caideFreeDiagnostics(CaideDiagnostic* diagnostics, int numDiagnostics) {
+    if (!diagnostics)
+        return;
+    for (int i = 0; i < numDiagnostics; ++i) {
+        std::free(const_cast<char*>(diagnostics[i].file));
+        std::free(const_cast<char*>(diagnostics[i].message));
+    }
+    std::free(diagnostics);
+}
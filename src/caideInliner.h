@@ -30,12 +30,51 @@ struct CaideCppInlinerOptions {
     int maxConsequentEmptyLines;
 };
 
+/*!
+    Returns 0 on success, 1 on failure (including compilation errors), 2 on unexpected failure.
+    Compiler diagnostics are printed to stderr.
+*/
 int caideInlineCppCode(
         const struct CaideCppInlinerOptions* options,
         const char** cppFilePaths,
         int numCppFiles,
         const char* outputFilePath);
 
+enum CaideDiagnosticSeverity {
+    CAIDE_DIAGNOSTIC_NOTE,
+    CAIDE_DIAGNOSTIC_WARNING,
+    CAIDE_DIAGNOSTIC_ERROR,
+    CAIDE_DIAGNOSTIC_FATAL
+};
+
+struct CaideDiagnostic {
+    enum CaideDiagnosticSeverity severity;
+    /* Empty string and zero line and column if there is no location */
+    const char* file;
+    int line;
+    int column;
+    const char* message;
+};
+
+/*!
+    Same as caideInlineCppCode, but compilation stops after errorLimit errors (0 means no limit),
+    and diagnostics are returned to the caller: on failure, all diagnostics reported before
+    compilation stopped; on success, warnings.
+
+    If diagnostics and numDiagnostics are not NULL, *diagnostics is set to an array
+    of *numDiagnostics elements that must be freed with caideFreeDiagnostics.
+*/
+int caideInlineCppCodeWithDiagnostics(
+        const struct CaideCppInlinerOptions* options,
+        int errorLimit,
+        const char** cppFilePaths,
+        int numCppFiles,
+        const char* outputFilePath,
+        struct CaideDiagnostic** diagnostics,
+        int* numDiagnostics);
+
+void caideFreeDiagnostics(struct CaideDiagnostic* diagnostics, int numDiagnostics);
+
 #ifdef __cplusplus
 } /* extern "C" */
 #endif
@@ -6,6 +6,10 @@
 
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <stdexcept>
 #include <string>
 #include <vector>
 
@@ -15,6 +19,118 @@
 
 namespace caide {
 
+/// \brief A message produced by the compiler
+struct CompilationDiagnostic {
+    enum class Severity { Note, Warning, Error, Fatal };
+
+    Severity severity;
+    /// Empty if the diagnostic doesn't refer to a location in source code
+    std::string file;
+    /// 1-based; 0 if the diagnostic doesn't refer to a location in source code
+    unsigned line;
+    unsigned column;
+    std::string message;
+};
+
+/// \brief Thrown by CppInliner::inlineCode() when the program doesn't compile
+class CompilationError: public std::runtime_error {
+public:
+    explicit CompilationError(std::vector<CompilationDiagnostic> diagnostics);
+
+    /// \brief All diagnostics reported before the compilation was aborted, in order
+    const std::vector<CompilationDiagnostic>& diagnostics() const;
+
+private:
+    std::vector<CompilationDiagnostic> diagnostics_;
+};
+
+/// \brief Statistics of one stage of CppInliner::inlineCode()
+struct StageStatistics {
+    /// \brief One of `plan`, `concat`, `inline`, `removePragmaOnce`, `optimize`,
+    /// `removeEmptyLines`, `verify`, `compileCost`
+    std::string name;
+    /// \brief false if the stage was skipped as unnecessary for the input
+    bool executed;
+    /// \brief true if the result of the stage was taken from the cache
+    /// (see CppInliner::cacheInlinedCode)
+    bool fromCache;
+    std::uint64_t elapsedMicroseconds;
+};
+
+/// \brief Additional information produced by CppInliner::inlineCode()
+struct InlinerResult {
+    /// \brief All stages of the pipeline in the order in which they are run, including
+    /// skipped ones
+    std::vector<StageStatistics> stages;
+
+    /// \brief Warnings (and notes attached to them) reported by the compiler
+    ///
+    /// Diagnostics of the `inline` stage come first, followed by those of the `optimize` stage.
+    /// A warning in code that both stages compile is reported twice.
+    ///
+    /// \note Locations in C++ files (as opposed to headers) refer to the file that the stage
+    /// compiled. If the `concat` stage was executed (see #stages), that is `concat.cpp` in the
+    /// temporary directory, a concatenation of all C++ files of the program. Otherwise the program
+    /// is a single C++ file that the stages compile directly, and locations refer to this file.
+    /// If the `removePragmaOnce` stage was executed, the `optimize` stage compiles `inlined.cpp`
+    /// in the temporary directory instead.
+    std::vector<CompilationDiagnostic> diagnostics;
+
+    /// \brief Why the declarations listed in CppInliner::declarationsToExplain were kept
+    ///
+    /// Empty if CppInliner::declarationsToExplain is empty.
+    std::string explanation;
+
+    /// \brief Compilation time of the output broken down by declarations
+    ///
+    /// Empty if CppInliner::analyzeCompileCost is false.
+    std::string compileCostReport;
+
+    /// \brief Number of declarations at namespace scope of the input of the `optimize` stage
+    /// whose dependencies were collected
+    ///
+    /// Template instantiations are counted separately. 0 unless CppInliner::lazyDependencyGraph
+    /// is set and the graph was built on demand.
+    std::size_t traversedDeclarations = 0;
+
+    /// \brief Diagnostics reported when compiling the output
+    ///
+    /// Empty if CppInliner::verifyOutput is false. If the list contains an error,
+    /// the inliner has produced an incorrect program.
+    ///
+    /// \note Locations refer to the input of the `optimize` stage (see CppInliner::inlineCode()).
+    std::vector<CompilationDiagnostic> verificationDiagnostics;
+};
+
+/// \brief Byte range [begin, end) of a buffer
+struct TextSpan {
+    std::size_t begin;
+    std::size_t end;
+};
+
+/// \brief Output of the inliner described as parts of a buffer
+///
+/// The output is the concatenation of `buffer[span.begin, span.end)` for all spans in order,
+/// followed by suffix.
+struct KeptSpans {
+    /// \brief The program with user headers inlined (the input of the `optimize` stage)
+    std::string buffer;
+    /// \brief Kept parts of the buffer; sorted, non-empty, and neither overlapping nor adjacent
+    std::vector<TextSpan> spans;
+    /// \brief Text that is not part of the buffer: empty, or a line break if the last
+    /// kept line doesn't end with one
+    std::string suffix;
+};
+
+/// \brief Write the output described by kept spans to a stream opened in binary mode
+void writeKeptSpans(const KeptSpans& output, std::ostream& out);
+
+/// \brief Result of one configuration of CppInliner::inlineCodeVariants()
+struct VariantOutput {
+    InlinerResult result;
+    KeptSpans output;
+};
+
 /// \brief C++ code inliner and unused code remover
 ///
 /// The C++ inliner transforms a program implemented as multiple C++ source files
@@ -44,8 +160,60 @@ public:
     /// All input C++ files and included user headers will be combined into a single C++ file,
     /// and only code reachable from main function will be kept. In addition, declarations
     /// marked with a comment 'caide keep' will be kept too.
-    void inlineCode(const std::vector<std::string>& cppFilePaths,
-                    const std::string& outputFilePath) const;
+    ///
+    /// The work is split in stages (see StageStatistics). A quick scan of preprocessor
+    /// directives decides which stages are necessary. For example, if the program is a single
+    /// C++ file that doesn't include user headers, unused code is removed from this file
+    /// directly; otherwise, from `inlined.cpp` in the temporary directory.
+    ///
+    /// \throw CompilationError if the program doesn't compile
+    InlinerResult inlineCode(const std::vector<std::string>& cppFilePaths,
+                             const std::string& outputFilePath) const;
+
+    /// \brief Generate a single-file C++ program and write it to a stream.
+    /// \param cppFilePaths full paths of all C++ files of a program
+    /// \param output stream where the inlined program will be written; should be opened
+    /// in binary mode
+    ///
+    /// Same as the other overload, but no output file is created. Useful for storing
+    /// many results in one container (see caidePackedOutput.hpp).
+    InlinerResult inlineCode(const std::vector<std::string>& cppFilePaths,
+                             std::ostream& output) const;
+
+    /// \brief Generate a single-file C++ program without building it as a string.
+    /// \param cppFilePaths full paths of all C++ files of a program
+    /// \param output the intermediate program and the parts of it that make up the result
+    ///
+    /// Same as the other overloads, but the result is described by the kept parts of
+    /// the intermediate program, e.g. for consumers that only need to know what has been
+    /// removed, or that write the spans directly.
+    InlinerResult inlineCode(const std::vector<std::string>& cppFilePaths,
+                             KeptSpans& output) const;
+
+    /// \brief Generate single-file C++ programs for several configurations of the same program.
+    /// \param cppFilePaths full paths of all C++ files of a program
+    /// \param optionVariants for each configuration, clang options that are added to
+    /// clangCompilationOptions, e.g. `{"-DLOCAL"}` or `{"-std=c++17"}`
+    /// \return one output per configuration, in the order of optionVariants
+    ///
+    /// Equivalent to calling inlineCode() for each configuration, but work that doesn't depend
+    /// on the configuration is done once: input files are read and scanned once, and C++ files
+    /// are concatenated once. Configurations with identical options are processed once.
+    /// Other configurations are processed concurrently.
+    ///
+    /// Intermediate files of a configuration are prefixed with `variant<N>-` in the temporary
+    /// directory, where N is the index of the configuration. If dependencyGraphFile is set,
+    /// the graph of configuration N is written to `dependencyGraphFile.N`. Tracing probes
+    /// of configuration N report job ID `jobId + N`.
+    ///
+    /// \note Stages shared by all configurations (`plan` and `concat`) report the same
+    /// statistics in every InlinerResult.
+    ///
+    /// \throw CompilationError if any configuration doesn't compile. All configurations
+    /// run to completion; the error of the first failed configuration is thrown.
+    std::vector<VariantOutput> inlineCodeVariants(
+        const std::vector<std::string>& cppFilePaths,
+        const std::vector<std::vector<std::string>>& optionVariants) const;
 
 
     /// \brief clang compilation options (see http://clang.llvm.org/docs/CommandGuide/clang.html
@@ -103,6 +271,171 @@ public:
     /// Default value is 2. If the parameter is negative, empty lines are not removed.
     int maxConsequentEmptyLines;
 
+
+    /// \brief number of compilation errors after which inlineCode() gives up
+    ///
+    /// Compilation is aborted as soon as the limit is reached (or a fatal error occurs),
+    /// and CompilationError is thrown with the diagnostics reported so far.
+    ///
+    /// Default value is 1. If the parameter is 0, the whole program is compiled
+    /// no matter how many errors it has.
+    int errorLimit;
+
+
+    /// \brief path to a file where the dependency graph of declarations will be written
+    ///
+    /// The graph is written in a compact binary format that can be queried with the
+    /// `caide-graph` tool. Nodes are semantic declarations (including declarations from
+    /// system headers); an edge from A to B means that A uses B.
+    ///
+    /// Default value is empty, meaning that the graph is not written.
+    std::string dependencyGraphFile;
+
+
+    /// \brief declarations for which the inliner should explain why they are kept
+    ///
+    /// Each entry is either a (possibly qualified) declaration name or `file:line`.
+    /// For each matching declaration, InlinerResult::explanation will contain the chain
+    /// of dependencies leading to it from main function or a 'caide keep' declaration,
+    /// e.g. `main calls solve, solve uses type SegTree`. The explanation also lists
+    /// the declarations responsible for the largest parts of the output, ranked
+    /// by the size of code kept only because of them.
+    ///
+    /// \note Files and line numbers refer to the input of the `optimize` stage
+    /// (see inlineCode()).
+    ///
+    /// Default value is empty.
+    std::vector<std::string> declarationsToExplain;
+
+
+    /// \brief whether to measure how long it takes to compile the output
+    ///
+    /// If set, the output is compiled with the same clangCompilationOptions after it has
+    /// been generated, and InlinerResult::compileCostReport lists the declarations of the output
+    /// that take the most time to parse and instantiate. Time spent on a template instantiation
+    /// is attributed to the template, and time spent in system headers is grouped by header.
+    /// Code generation is not included.
+    ///
+    /// Default value is false.
+    bool analyzeCompileCost;
+
+
+    /// \brief whether to check that the output compiles
+    ///
+    /// If set, the output is compiled (without code generation) right after it has been
+    /// generated, and the diagnostics are stored in InlinerResult::verificationDiagnostics.
+    /// This reuses the state of the compiler instance that removed unused code (including
+    /// the cache of system header files), so it is cheaper than a separate compiler run.
+    ///
+    /// Default value is false.
+    bool verifyOutput;
+
+
+    /// \brief whether to remove code unreachable from main function
+    ///
+    /// If false, the output is the input with user headers inlined.
+    /// In this case, verifyOutput has no effect.
+    ///
+    /// Default value is true.
+    bool removeUnusedCode;
+
+
+    /// \brief whether to reuse the result of the `inline` stage from the previous run
+    ///
+    /// If set, the program with user headers inlined is saved in the temporary directory,
+    /// together with the hashes of all headers included from user code. The next call to
+    /// inlineCode() with the same temporary directory reuses the saved result if the C++ files,
+    /// the headers and clangCompilationOptions are unchanged. This speeds up repeated runs that
+    /// differ only in options of later stages, e.g. macrosToKeep or maxConsequentEmptyLines.
+    ///
+    /// The saved result also records which of its parts are copied from which headers. If a header
+    /// has changed but its preprocessor directives (includes, include guards, conditions etc.)
+    /// are exactly the same, the saved result is patched with the new text of the header instead
+    /// of running the `inline` stage again. This makes editing the body of a header cheap.
+    ///
+    /// The saved result is not used if the current directory or an include path variable
+    /// (e.g. `CPLUS_INCLUDE_PATH`) has changed, or if a header has been created where
+    /// an include directive would now find it first (e.g. a file with the same name in
+    /// an earlier include directory).
+    /// \note When the cached result is used, the warnings of the `inline` stage are those reported
+    /// when the result was saved; for a patched result, they may refer to the old text of headers.
+    ///
+    /// Default value is false.
+    bool cacheInlinedCode;
+
+
+    /// \brief whether to skip the contents of system headers when inlining user headers
+    ///
+    /// If set, the `inline` stage only runs the preprocessor, and system headers are not
+    /// processed at all, so that the time of the stage depends on the size of user code only.
+    /// If a preprocessor condition in user code checks a macro that may be defined in a system
+    /// header and is undefined at that point (a name reserved for the implementation, such as
+    /// `_GLIBCXX_DEBUG`, or a standard macro, such as `INT_MAX`), the stage is run again with
+    /// system headers. Include guards of user headers and macros like `LOCAL` don't cause this.
+    /// The output is the same either way.
+    ///
+    /// \note Compilation errors in user code are reported by the `optimize` stage
+    /// instead of the `inline` stage.
+    ///
+    /// Default value is false.
+    bool opaqueSystemHeaders;
+
+    /// \brief whether to skip bodies of non-template functions in system headers
+    /// in the `optimize` stage
+    ///
+    /// Such a body can't refer to user code, so it doesn't affect the result, but parsing it
+    /// takes a large part of the compilation time of a typical solution. Bodies of templates
+    /// are still parsed and instantiated. If the code doesn't compile in this mode
+    /// (e.g. a skipped body is needed to evaluate a constant expression), the stage
+    /// is run again with all bodies. The output is the same either way.
+    ///
+    /// Default value is false.
+    bool skipSystemFunctionBodies;
+
+    /// \brief whether to build the dependency graph of declarations on demand
+    ///
+    /// By default, the `optimize` stage collects dependencies of every declaration,
+    /// including unused library code and its template instantiations, and only then finds
+    /// the declarations reachable from main function and 'caide keep' declarations. If set,
+    /// the input file is only scanned for these roots, and every declaration (together with its
+    /// template instantiations) is traversed only when it is reached, so that the time of
+    /// the stage depends on the size of the code that is used rather than the size of
+    /// the program and the included headers. The output is the same either way.
+    ///
+    /// \note The whole graph is still built if dependencyGraphFile or declarationsToExplain
+    /// is set.
+    ///
+    /// Default value is false.
+    bool lazyDependencyGraph;
+
+    /// \brief identifier of the job, reported by tracing probes
+    ///
+    /// If the library is built with `sys/sdt.h`, USDT probes of provider `caide` mark
+    /// the start and the end of every stage of inlineCode() and of the steps of
+    /// the `optimize` stage (see caide_probes.h and tools/bpftrace). The job ID lets
+    /// a tracer tell apart concurrent jobs of the same process.
+    ///
+    /// Default value is 0.
+    std::uint64_t jobId;
+
+    /// \brief file that persists the results of the clang driver between processes
+    ///
+    /// Before compiling, every stage runs the clang driver to turn clangCompilationOptions
+    /// into frontend options, which involves probing the file system for the GCC installation,
+    /// the standard library headers etc. The result is cached in memory and reused by all
+    /// stages and all subsequent calls with the same options, working directory and
+    /// environment. If set, the cache is also stored in this file and loaded from it, so that
+    /// the driver doesn't run again in a new process. Warnings of the driver are stored too,
+    /// and reported when a stored result is used.
+    ///
+    /// New results are written once at the end of inlineCode() or inlineCodeVariants().
+    /// std::runtime_error is thrown if the file can't be written, unless a stage has failed.
+    ///
+    /// \note The file must be deleted when the compiler installation changes.
+    ///
+    /// Default value is empty (the cache is not persisted).
+    std::string driverCacheFile;
+
 private:
     const std::string temporaryDirectory;
 };
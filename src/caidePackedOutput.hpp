@@ -0,0 +1,133 @@
+//                        Caide C++ inliner
+//
+// This file is distributed under the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version. See LICENSE.TXT for details.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+/// \file caidePackedOutput.hpp
+/// \brief Append-only container for the results of many inliner jobs
+///
+/// Instead of writing one small file per job, all outputs are appended to a single
+/// data file (`<container>.data`), and a fixed-size record per output is appended to
+/// an index file (`<container>.index`). The index starts with an 8-byte magic string
+/// followed by PackedOutputEntry records in native byte order.
+
+
+namespace caide {
+
+namespace internal {
+    class MappedFile;
+}
+
+/// \brief Index record describing one output stored in a container
+struct PackedOutputEntry {
+    /// Caller-defined job identifier
+    std::uint64_t jobId;
+    /// Offset of the output in the data file
+    std::uint64_t offset;
+    /// Length of the output in bytes
+    std::uint64_t length;
+    /// 0 if the job succeeded. Otherwise the stored output is an error message.
+    std::int32_t status;
+    std::uint32_t reserved;
+    /// Wall time spent on the job
+    std::uint64_t elapsedMicroseconds;
+    /// 64-bit FNV-1a hash of the output
+    std::uint64_t contentHash;
+};
+
+
+/// \brief Appends outputs to a container, batching the writes
+///
+/// Data is written to disk when the buffered outputs exceed the buffer size, when flush()
+/// is called, and on destruction. The data file is always written before the index, so
+/// the index never refers to missing data.
+///
+/// \note The destructor can't report errors. Call flush() before destroying the writer
+/// to make sure that the outputs are stored.
+///
+/// \note Only one writer may append to a container at a time.
+class PackedOutputWriter {
+public:
+    /// \brief Open a container for appending, creating it if it doesn't exist
+    /// \param containerPath path of the container without the `.data`/`.index` extension
+    /// \param bufferSize number of bytes of outputs to accumulate before writing them to disk
+    explicit PackedOutputWriter(const std::string& containerPath,
+                                std::size_t bufferSize = 1 << 20);
+    ~PackedOutputWriter();
+
+    PackedOutputWriter(const PackedOutputWriter&) = delete;
+    PackedOutputWriter& operator=(const PackedOutputWriter&) = delete;
+
+    void append(std::uint64_t jobId, const std::string& content, int status,
+                std::uint64_t elapsedMicroseconds);
+
+    /// \brief Write the buffered outputs to disk
+    /// \throw std::runtime_error if the container can't be written. The outputs stay buffered,
+    /// and flush() may be called again; data that was already written is not appended twice.
+    void flush();
+
+private:
+    const std::string dataPath;
+    const std::string indexPath;
+    const std::size_t bufferSize;
+
+    /// Size of the data file, including the buffered data
+    std::uint64_t dataSize;
+
+    std::string pendingData;
+    /// Number of bytes of pendingData already in the data file (after a failed flush)
+    std::size_t pendingDataWritten;
+    std::vector<PackedOutputEntry> pendingEntries;
+};
+
+
+/// \brief Random read access to a container
+///
+/// Both files of the container are memory-mapped; the contents are not copied.
+/// Entries appended after the reader was created are not visible.
+class PackedOutputReader {
+public:
+    /// \param containerPath path of the container without the `.data`/`.index` extension
+    explicit PackedOutputReader(const std::string& containerPath);
+    ~PackedOutputReader();
+
+    PackedOutputReader(const PackedOutputReader&) = delete;
+    PackedOutputReader& operator=(const PackedOutputReader&) = delete;
+
+    static const std::size_t npos = static_cast<std::size_t>(-1);
+
+    /// \brief Number of entries in the container
+    std::size_t size() const;
+
+    /// \throw std::runtime_error if the entry refers to data outside of the data file
+    const PackedOutputEntry& entry(std::size_t i) const;
+
+    /// \brief Pointer to the output described by entry(i); its length is entry(i).length
+    const char* data(std::size_t i) const;
+
+    /// \brief Copy of the output described by entry(i)
+    std::string content(std::size_t i) const;
+
+    /// \brief Index of the most recently appended entry with given job id, or npos
+    std::size_t find(std::uint64_t jobId) const;
+
+private:
+    std::unique_ptr<internal::MappedFile> indexFile;
+    std::unique_ptr<internal::MappedFile> dataFile;
+    const PackedOutputEntry* entries;
+    std::size_t numEntries;
+
+    bool isInDataFile(const PackedOutputEntry& entry) const;
+};
+
+} // namespace caide
+
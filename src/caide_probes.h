@@ -0,0 +1,41 @@
+//                        Caide C++ inliner
+//
+// This file is distributed under the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version. See LICENSE.TXT for details.
+
+#pragma once
+
+// Static tracepoints (USDT, provider `caide`) for perf and bpftrace. A probe compiles to a
+// single nop and costs nothing unless a tracer is attached; see tools/bpftrace for examples.
+//
+// Probes:
+//   stage__start(jobId, stageName, inputSize)
+//   stage__end(jobId, stageName, executed, elapsedMicroseconds)
+//   optimize__step__start(jobId, stepName)
+//   optimize__step__end(jobId, stepName, count)
+//
+// Sizes are in bytes; count is the number of items produced by the step (declarations,
+// graph nodes etc.)
+
+#ifdef CAIDE_HAVE_SYS_SDT_H
+
+#include <sys/sdt.h>
+
+#define CAIDE_PROBE2(name, arg1, arg2) DTRACE_PROBE2(caide, name, arg1, arg2)
+#define CAIDE_PROBE3(name, arg1, arg2, arg3) DTRACE_PROBE3(caide, name, arg1, arg2, arg3)
+#define CAIDE_PROBE4(name, arg1, arg2, arg3, arg4) \
+    DTRACE_PROBE4(caide, name, arg1, arg2, arg3, arg4)
+
+#else
+
+// Arguments are not evaluated
+#define CAIDE_PROBE2(name, arg1, arg2) \
+    do { (void)sizeof(arg1); (void)sizeof(arg2); } while (false)
+#define CAIDE_PROBE3(name, arg1, arg2, arg3) \
+    do { CAIDE_PROBE2(name, arg1, arg2); (void)sizeof(arg3); } while (false)
+#define CAIDE_PROBE4(name, arg1, arg2, arg3, arg4) \
+    do { CAIDE_PROBE3(name, arg1, arg2, arg3); (void)sizeof(arg4); } while (false)
+
+#endif
+
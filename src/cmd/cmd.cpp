@@ -1,14 +1,68 @@
 #include "../caideInliner.hpp"
+#include "../caidePackedOutput.hpp"
 
+#include <chrono>
+#include <cstdint>
 #include <cstdlib>
+#include <fstream>
 #include <iostream>
+#include <memory>
+#include <sstream>
 #include <stdexcept>
 #include <string>
+#include <vector>
 
 
 using namespace std;
 
+static void printDiagnostic(ostream& out, const caide::CompilationDiagnostic& diagnostic) {
+    if (!diagnostic.file.empty())
+        out << diagnostic.file << ":" << diagnostic.line << ":" << diagnostic.column << ": ";
+    switch (diagnostic.severity) {
+        case caide::CompilationDiagnostic::Severity::Note:
+            out << "note: ";
+            break;
+        case caide::CompilationDiagnostic::Severity::Warning:
+            out << "warning: ";
+            break;
+        case caide::CompilationDiagnostic::Severity::Error:
+            out << "error: ";
+            break;
+        case caide::CompilationDiagnostic::Severity::Fatal:
+            out << "fatal error: ";
+            break;
+    }
+    out << diagnostic.message << endl;
+}
+
+// Options of a variant are separated by spaces
+static vector<string> splitOptions(const string& options) {
+    vector<string> result;
+    istringstream in(options);
+    string option;
+    while (in >> option)
+        result.push_back(option);
+    return result;
+}
+
+static string getVariantOutputFile(const string& outputFile, size_t variant) {
+    size_t extension = outputFile.rfind('.');
+    const size_t fileName = outputFile.find_last_of("/\\");
+    if (extension == string::npos || (fileName != string::npos && extension < fileName))
+        extension = outputFile.size();
+    return outputFile.substr(0, extension) + "." + to_string(variant) +
+        outputFile.substr(extension);
+}
+
 int main(int argc, const char* argv[]) {
+    string packedOutput;
+    uint64_t jobId = 0;
+    auto startTime = chrono::steady_clock::now();
+    auto elapsedMicroseconds = [&] {
+        return static_cast<uint64_t>(chrono::duration_cast<chrono::microseconds>(
+            chrono::steady_clock::now() - startTime).count());
+    };
+
     try {
         vector<string> sourceFiles;
         string tmpDirectory = "./caide-tmp";
@@ -22,6 +76,34 @@ int main(int argc, const char* argv[]) {
         const string outputFlag = "-o";
         const string keepMacrosFlag = "-k";
         const string emptyLinesFlag = "-l";
+        const string packedOutputFlag = "-p";
+        const string jobIdFlag = "-j";
+        const string graphFlag = "-g";
+        const string explainFlag = "--explain";
+        const string compileCostFlag = "--compile-cost";
+        const string errorLimitFlag = "--error-limit";
+        const string verifyFlag = "--verify";
+        const string keepUnusedFlag = "--keep-unused";
+        const string statsFlag = "--stats";
+        const string cacheFlag = "--cache";
+        const string variantFlag = "--variant";
+        const string opaqueSystemHeadersFlag = "--opaque-system-headers";
+        bool opaqueSystemHeaders = false;
+        const string skipSystemFunctionBodiesFlag = "--skip-system-function-bodies";
+        bool skipSystemFunctionBodies = false;
+        const string lazyDependencyGraphFlag = "--lazy-dependency-graph";
+        bool lazyDependencyGraph = false;
+        const string driverCacheFlag = "--driver-cache";
+        string driverCacheFile;
+        vector<vector<string>> optionVariants;
+        bool cacheInlinedCode = false;
+        bool removeUnusedCode = true;
+        bool printStats = false;
+        bool verifyOutput = false;
+        int errorLimit = 1;
+        bool analyzeCompileCost = false;
+        string dependencyGraphFile;
+        vector<string> declarationsToExplain;
 
         int i = 1;
         for (; i < argc && clangOptionsEnd != argv[i]; ++i) {
@@ -41,6 +123,43 @@ int main(int argc, const char* argv[]) {
             } else if (emptyLinesFlag == argv[i]) {
                 ++i;
                 if (i < argc) maxConsecutiveEmptyLines = strtol(argv[i], nullptr, 10);
+            } else if (packedOutputFlag == argv[i]) {
+                ++i;
+                if (i < argc) packedOutput = argv[i];
+            } else if (jobIdFlag == argv[i]) {
+                ++i;
+                if (i < argc) jobId = strtoull(argv[i], nullptr, 10);
+            } else if (graphFlag == argv[i]) {
+                ++i;
+                if (i < argc) dependencyGraphFile = argv[i];
+            } else if (keepUnusedFlag == argv[i]) {
+                removeUnusedCode = false;
+            } else if (cacheFlag == argv[i]) {
+                cacheInlinedCode = true;
+            } else if (opaqueSystemHeadersFlag == argv[i]) {
+                opaqueSystemHeaders = true;
+            } else if (skipSystemFunctionBodiesFlag == argv[i]) {
+                skipSystemFunctionBodies = true;
+            } else if (lazyDependencyGraphFlag == argv[i]) {
+                lazyDependencyGraph = true;
+            } else if (driverCacheFlag == argv[i]) {
+                ++i;
+                if (i < argc) driverCacheFile = argv[i];
+            } else if (variantFlag == argv[i]) {
+                ++i;
+                if (i < argc) optionVariants.push_back(splitOptions(argv[i]));
+            } else if (statsFlag == argv[i]) {
+                printStats = true;
+            } else if (verifyFlag == argv[i]) {
+                verifyOutput = true;
+            } else if (errorLimitFlag == argv[i]) {
+                ++i;
+                if (i < argc) errorLimit = strtol(argv[i], nullptr, 10);
+            } else if (compileCostFlag == argv[i]) {
+                analyzeCompileCost = true;
+            } else if (explainFlag == argv[i]) {
+                ++i;
+                if (i < argc) declarationsToExplain.emplace_back(argv[i]);
             } else {
                 sourceFiles.emplace_back(argv[i]);
             }
@@ -51,9 +170,97 @@ int main(int argc, const char* argv[]) {
         inliner.macrosToKeep.insert(inliner.macrosToKeep.end(),
             macrosToKeep.begin(), macrosToKeep.end());
         inliner.maxConsequentEmptyLines = maxConsecutiveEmptyLines;
-        inliner.inlineCode(sourceFiles, outputFile);
+        inliner.errorLimit = errorLimit;
+        inliner.verifyOutput = verifyOutput;
+        inliner.removeUnusedCode = removeUnusedCode;
+        inliner.cacheInlinedCode = cacheInlinedCode;
+        inliner.opaqueSystemHeaders = opaqueSystemHeaders;
+        inliner.skipSystemFunctionBodies = skipSystemFunctionBodies;
+        inliner.lazyDependencyGraph = lazyDependencyGraph;
+        inliner.jobId = jobId;
+        inliner.driverCacheFile = driverCacheFile;
+        inliner.dependencyGraphFile = dependencyGraphFile;
+        inliner.declarationsToExplain = declarationsToExplain;
+        inliner.analyzeCompileCost = analyzeCompileCost;
+        vector<caide::InlinerResult> inlinerResults;
+        if (!optionVariants.empty()) {
+            // Output of variant N goes to the output file with .N inserted before
+            // the extension, or to the packed output as job jobId + N
+            vector<caide::VariantOutput> outputs =
+                inliner.inlineCodeVariants(sourceFiles, optionVariants);
+            unique_ptr<caide::PackedOutputWriter> writer;
+            if (!packedOutput.empty())
+                writer.reset(new caide::PackedOutputWriter(packedOutput));
+            for (size_t variant = 0; variant < outputs.size(); ++variant) {
+                if (!writer) {
+                    ofstream out(getVariantOutputFile(outputFile, variant), ios::binary);
+                    caide::writeKeptSpans(outputs[variant].output, out);
+                } else {
+                    ostringstream result;
+                    caide::writeKeptSpans(outputs[variant].output, result);
+                    writer->append(jobId + variant, result.str(), 0, elapsedMicroseconds());
+                }
+                inlinerResults.push_back(std::move(outputs[variant].result));
+            }
+            // Throws if the container can't be written
+            if (writer)
+                writer->flush();
+        } else if (packedOutput.empty()) {
+            inlinerResults.push_back(inliner.inlineCode(sourceFiles, outputFile));
+        } else {
+            ostringstream result;
+            inlinerResults.push_back(inliner.inlineCode(sourceFiles, result));
+            caide::PackedOutputWriter writer(packedOutput);
+            writer.append(jobId, result.str(), 0, elapsedMicroseconds());
+            writer.flush();
+        }
+
+        bool verificationFailed = false;
+        for (size_t variant = 0; variant < inlinerResults.size(); ++variant) {
+            const caide::InlinerResult& inlinerResult = inlinerResults[variant];
+            if (!optionVariants.empty())
+                cerr << "variant " << variant << ":" << endl;
+            for (const caide::CompilationDiagnostic& diagnostic : inlinerResult.diagnostics)
+                printDiagnostic(cerr, diagnostic);
+            if (printStats) {
+                for (const caide::StageStatistics& stage : inlinerResult.stages) {
+                    cerr << stage.name << ": ";
+                    if (stage.fromCache)
+                        cerr << "cached, " << stage.elapsedMicroseconds << " us" << endl;
+                    else if (stage.executed)
+                        cerr << stage.elapsedMicroseconds << " us" << endl;
+                    else
+                        cerr << "skipped" << endl;
+                }
+            }
+            cout << inlinerResult.explanation << inlinerResult.compileCostReport;
+
+            for (const caide::CompilationDiagnostic& diagnostic : inlinerResult.verificationDiagnostics) {
+                printDiagnostic(cerr, diagnostic);
+                if (diagnostic.severity == caide::CompilationDiagnostic::Severity::Error ||
+                        diagnostic.severity == caide::CompilationDiagnostic::Severity::Fatal)
+                    verificationFailed = true;
+            }
+        }
+        if (verificationFailed) {
+            cerr << "The output doesn't compile" << endl;
+            return 1;
+        }
     } catch (const exception& e) {
+        if (const auto* compilationError = dynamic_cast<const caide::CompilationError*>(&e)) {
+            for (const caide::CompilationDiagnostic& diagnostic : compilationError->diagnostics())
+                printDiagnostic(cerr, diagnostic);
+        }
         cerr << e.what() << endl;
+        if (!packedOutput.empty()) {
+            try {
+                caide::PackedOutputWriter writer(packedOutput);
+                writer.append(jobId, e.what(), 1, elapsedMicroseconds());
+                writer.flush();
+            } catch (const exception& e2) {
+                cerr << e2.what() << endl;
+            }
+        }
         return 1;
     }
 
@@ -0,0 +1,288 @@
+#include "../GraphFormat.h"
+#include "../MappedFile.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+
+using namespace std;
+using caide::internal::GraphFileHeader;
+using caide::internal::GraphNode;
+
+// Read-only view of a graph file. Sections are accessed in place, so only the parts
+// of the file that a query touches are actually read. The layout of the sections is checked
+// when the file is opened; offsets and indices stored in the sections are checked when
+// a query reads them.
+class Graph {
+public:
+    explicit Graph(const string& filePath_)
+        : filePath(filePath_)
+        , file(filePath_)
+    {
+        if (file.size() < sizeof(GraphFileHeader))
+            fail();
+        header = reinterpret_cast<const GraphFileHeader*>(file.begin());
+        if (memcmp(header->magic, caide::internal::graphFileMagic, sizeof(header->magic)) != 0 ||
+                header->numNodes > numeric_limits<uint32_t>::max() ||
+                header->numStrings > numeric_limits<uint32_t>::max())
+            fail();
+
+        // Every section must be aligned and lie within the file
+        const uint64_t numNodes = header->numNodes, numStrings = header->numStrings;
+        if (!isSection(header->nodesOffset, numNodes, sizeof(GraphNode)) ||
+                !isSection(header->edgeOffsetsOffset, numNodes + 1, sizeof(uint64_t)) ||
+                !isSection(header->edgeTargetsOffset, header->numEdges, sizeof(uint32_t)) ||
+                !isSection(header->stringOffsetsOffset, numStrings + 1, sizeof(uint64_t)) ||
+                !isSection(header->stringDataOffset, 0, 1))
+            fail();
+
+        stringOffsets = section<uint64_t>(header->stringOffsetsOffset);
+        stringData = file.begin() + header->stringDataOffset;
+        stringDataSize = file.size() - header->stringDataOffset;
+        nodes = section<GraphNode>(header->nodesOffset);
+        edgeOffsets = section<uint64_t>(header->edgeOffsetsOffset);
+        edgeTargets = section<uint32_t>(header->edgeTargetsOffset);
+    }
+
+    uint32_t numNodes() const { return static_cast<uint32_t>(header->numNodes); }
+    uint64_t numEdges() const { return header->numEdges; }
+
+    const GraphNode& node(uint32_t i) const {
+        if (i >= header->numNodes)
+            fail();
+        return nodes[i];
+    }
+
+    string str(uint32_t i) const {
+        uint64_t begin = 0, end = 0;
+        stringRange(i, begin, end);
+        return string(stringData + begin, stringData + end);
+    }
+
+    // Out-edges of node i are edgeTarget(e) for e in [edgesBegin(i), edgesEnd(i))
+    uint64_t edgesBegin(uint32_t i) const {
+        checkEdgeRange(i);
+        return edgeOffsets[i];
+    }
+    uint64_t edgesEnd(uint32_t i) const {
+        checkEdgeRange(i);
+        return edgeOffsets[i+1];
+    }
+    uint32_t edgeTarget(uint64_t e) const {
+        if (e >= header->numEdges || edgeTargets[e] >= header->numNodes)
+            fail();
+        return edgeTargets[e];
+    }
+
+    uint64_t outDegree(uint32_t i) const { return edgesEnd(i) - edgesBegin(i); }
+
+    vector<uint64_t> inDegrees() const {
+        vector<uint64_t> res(numNodes(), 0);
+        for (uint64_t e = 0; e < numEdges(); ++e)
+            ++res[edgeTarget(e)];
+        return res;
+    }
+
+    // Nodes whose qualified name is `name`
+    vector<uint32_t> findNodes(const string& name) const {
+        // Compare with the string table first, so that only one string is compared per name.
+        vector<char> matchingStrings(header->numStrings, 0);
+        for (uint32_t i = 0; i < header->numStrings; ++i) {
+            uint64_t begin = 0, end = 0;
+            stringRange(i, begin, end);
+            matchingStrings[i] = end - begin == name.size() &&
+                memcmp(stringData + begin, name.data(), name.size()) == 0;
+        }
+        vector<uint32_t> res;
+        for (uint32_t i = 0; i < numNodes(); ++i) {
+            const uint32_t nameIndex = node(i).name;
+            if (nameIndex >= header->numStrings)
+                fail();
+            if (matchingStrings[nameIndex])
+                res.push_back(i);
+        }
+        return res;
+    }
+
+    string label(uint32_t i) const {
+        const GraphNode& n = node(i);
+        string res = str(n.kind) + " " + str(n.name) + " <" + str(n.file) + ":" +
+            to_string(n.beginLine) + ":" + to_string(n.beginColumn) + "-" +
+            to_string(n.endLine) + ":" + to_string(n.endColumn) + ">";
+        if (n.flags & caide::internal::GraphNodeIsRoot)
+            res += " [root]";
+        return res;
+    }
+
+private:
+    [[noreturn]] void fail() const {
+        throw runtime_error("Not a dependency graph file or the file is corrupted: " + filePath);
+    }
+
+    // Whether count elements of given size starting at offset fit in the file
+    bool isSection(uint64_t offset, uint64_t count, uint64_t elementSize) const {
+        return offset % 8 == 0 && offset <= file.size() &&
+            count <= (file.size() - offset) / elementSize;
+    }
+
+    template<typename T>
+    const T* section(uint64_t offset) const {
+        return reinterpret_cast<const T*>(file.begin() + offset);
+    }
+
+    void stringRange(uint32_t i, uint64_t& begin, uint64_t& end) const {
+        if (i >= header->numStrings)
+            fail();
+        begin = stringOffsets[i];
+        end = stringOffsets[i+1];
+        if (begin > end || end > stringDataSize)
+            fail();
+    }
+
+    void checkEdgeRange(uint32_t i) const {
+        if (i >= header->numNodes || edgeOffsets[i] > edgeOffsets[i+1] ||
+                edgeOffsets[i+1] > header->numEdges)
+            fail();
+    }
+
+    const string filePath;
+    caide::internal::MappedFile file;
+    const GraphFileHeader* header;
+    const uint64_t* stringOffsets;
+    const char* stringData;
+    uint64_t stringDataSize;
+    const GraphNode* nodes;
+    const uint64_t* edgeOffsets;
+    const uint32_t* edgeTargets;
+};
+
+static void usage() {
+    cerr << "Usage:\n"
+         << "  caide-graph <graph> summary\n"
+         << "  caide-graph <graph> degree <qualified name>\n"
+         << "  caide-graph <graph> reach [<qualified name>]  (default: from the roots)\n"
+         << "  caide-graph <graph> hubs [<count>] [in|out]\n";
+}
+
+static vector<uint32_t> roots(const Graph& graph) {
+    vector<uint32_t> res;
+    for (uint32_t i = 0; i < graph.numNodes(); ++i) {
+        if (graph.node(i).flags & caide::internal::GraphNodeIsRoot)
+            res.push_back(i);
+    }
+    return res;
+}
+
+static void summary(const Graph& graph) {
+    uint32_t numMainFileNodes = 0;
+    for (uint32_t i = 0; i < graph.numNodes(); ++i) {
+        if (graph.node(i).flags & caide::internal::GraphNodeIsInMainFile)
+            ++numMainFileNodes;
+    }
+    cout << "nodes: " << graph.numNodes() << "\n"
+         << "edges: " << graph.numEdges() << "\n"
+         << "nodes in main file: " << numMainFileNodes << "\n"
+         << "roots: " << roots(graph).size() << "\n";
+}
+
+static void degree(const Graph& graph, const string& name) {
+    vector<uint32_t> found = graph.findNodes(name);
+    if (found.empty()) {
+        cout << "Not found: " << name << "\n";
+        return;
+    }
+    vector<uint64_t> inDegrees = graph.inDegrees();
+    for (uint32_t i : found)
+        cout << graph.label(i) << "\n  in: " << inDegrees[i] << ", out: " << graph.outDegree(i) << "\n";
+}
+
+static void reach(const Graph& graph, const vector<uint32_t>& sources) {
+    vector<char> seen(graph.numNodes(), 0);
+    vector<uint32_t> stack;
+    for (uint32_t i : sources) {
+        if (!seen[i]) {
+            seen[i] = 1;
+            stack.push_back(i);
+        }
+    }
+    vector<uint32_t> reached;
+    while (!stack.empty()) {
+        uint32_t i = stack.back();
+        stack.pop_back();
+        reached.push_back(i);
+        for (uint64_t e = graph.edgesBegin(i); e != graph.edgesEnd(i); ++e) {
+            const uint32_t target = graph.edgeTarget(e);
+            if (!seen[target]) {
+                seen[target] = 1;
+                stack.push_back(target);
+            }
+        }
+    }
+
+    sort(reached.begin(), reached.end());
+    for (uint32_t i : reached)
+        cout << graph.label(i) << "\n";
+    cout << reached.size() << " nodes reachable\n";
+}
+
+static void hubs(const Graph& graph, size_t count, bool byInDegree) {
+    vector<uint64_t> degrees;
+    if (byInDegree)
+        degrees = graph.inDegrees();
+    else {
+        degrees.resize(graph.numNodes());
+        for (uint32_t i = 0; i < graph.numNodes(); ++i)
+            degrees[i] = graph.outDegree(i);
+    }
+
+    vector<uint32_t> order(graph.numNodes());
+    for (uint32_t i = 0; i < graph.numNodes(); ++i)
+        order[i] = i;
+    count = min(count, order.size());
+    partial_sort(order.begin(), order.begin() + count, order.end(),
+        [&](uint32_t lhs, uint32_t rhs) { return degrees[lhs] > degrees[rhs]; });
+
+    for (size_t i = 0; i < count; ++i)
+        cout << degrees[order[i]] << "\t" << graph.label(order[i]) << "\n";
+}
+
+int main(int argc, const char* argv[]) {
+    if (argc < 3) {
+        usage();
+        return 1;
+    }
+
+    try {
+        Graph graph(argv[1]);
+        const string command = argv[2];
+        if (command == "summary") {
+            summary(graph);
+        } else if (command == "degree" && argc > 3) {
+            degree(graph, argv[3]);
+        } else if (command == "reach") {
+            if (argc > 3)
+                reach(graph, graph.findNodes(argv[3]));
+            else
+                reach(graph, roots(graph));
+        } else if (command == "hubs") {
+            size_t count = argc > 3 ? strtoul(argv[3], nullptr, 10) : 20;
+            bool byInDegree = argc <= 4 || string(argv[4]) != "out";
+            hubs(graph, count, byInDegree);
+        } else {
+            usage();
+            return 1;
+        }
+    } catch (const exception& e) {
+        cerr << e.what() << endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,37 @@
+//                        Caide C++ inliner
+//
+// This file is distributed under the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version. See LICENSE.TXT for details.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace caide {
+namespace internal {
+
+const std::uint64_t fnv1aOffsetBasis = 14695981039346656037ULL;
+
+// 64-bit FNV-1a. Not cryptographic; used to detect changes in contents.
+// Pass the result of a previous call as `hash` to hash several pieces of data as one.
+inline std::uint64_t fnv1aHash(const char* data, std::size_t size,
+                               std::uint64_t hash = fnv1aOffsetBasis)
+{
+    const std::uint64_t prime = 1099511628211ULL;
+    for (std::size_t i = 0; i < size; ++i) {
+        hash ^= static_cast<unsigned char>(data[i]);
+        hash *= prime;
+    }
+    return hash;
+}
+
+inline std::uint64_t fnv1aHash(const std::string& data, std::uint64_t hash = fnv1aOffsetBasis) {
+    return fnv1aHash(data.data(), data.size(), hash);
+}
+
+}
+}
+
@@ -5,6 +5,9 @@
 // option) any later version. See LICENSE.TXT for details.
 
 #include "inliner.h"
+#include "DiagnosticsCollector.h"
+#include "FrontendTool.h"
+#include "OpaqueSystemHeaders.h"
 #include "util.h"
 
 #include <clang/AST/ASTConsumer.h>
@@ -13,11 +16,17 @@
 #include <clang/Basic/SourceManager.h>
 #include <clang/Frontend/CompilerInstance.h>
 #include <clang/Frontend/FrontendAction.h>
+#include <clang/Frontend/FrontendActions.h>
+#include <clang/Lex/HeaderSearch.h>
 #include <clang/Lex/Preprocessor.h>
 #include <clang/Rewrite/Core/Rewriter.h>
 #include <clang/Tooling/CompilationDatabase.h>
 #include <clang/Tooling/Tooling.h>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Path.h>
 
+#include <cstring>
 #include <iostream>
 #include <memory>
 #include <set>
@@ -39,15 +48,21 @@ struct IncludeReplacement {
     SourceRange includeDirectiveRange;
     string fileName;
     string replaceWith;
+    // Where replaceWith comes from (if the segment map is built)
+    vector<InlinedSegment> segments;
 };
 
 class TrackMacro: public PPCallbacks {
 public:
-    TrackMacro(SourceManager& srcManager_, set<string>& includedHeaders_,
-               vector<IncludeReplacement>& replacements_)
+    TrackMacro(SourceManager& srcManager_, HeaderSearch& headerSearch_,
+               set<string>& includedHeaders_, set<string>& shadowingPaths_,
+               vector<IncludeReplacement>& replacements_, bool buildSegmentMap_)
         : srcManager(srcManager_)
+        , headerSearch(headerSearch_)
         , includedHeaders(includedHeaders_)
+        , shadowingPaths(shadowingPaths_)
         , replacementStack(replacements_)
+        , buildSegmentMap(buildSegmentMap_)
     {
         // Setup a placeholder where the result for the whole CPP file will be stored
         replacementStack.resize(1);
@@ -57,10 +72,10 @@ public:
     virtual void InclusionDirective(SourceLocation HashLoc,
                                     const Token& /*IncludeTok*/,
                                     StringRef FileName,
-                                    bool /*IsAngled*/,
+                                    bool IsAngled,
                                     CharSourceRange FilenameRange,
                                     const FileEntry *File,
-                                    StringRef /*SearchPath*/,
+                                    StringRef SearchPath,
                                     StringRef /*RelativePath*/,
                                     const Module* /*Imported*/) override
     {
@@ -84,13 +99,18 @@ public:
             return;
         }
 
+        addShadowingPaths(HashLoc, FileName, IsAngled, SearchPath);
+
         IncludeReplacement rep;
         rep.includeDirectiveRange = SourceRange(HashLoc, end);
         rep.fileName = getCanonicalPath(srcManager.getFileEntryForID(srcManager.getFileID(HashLoc)));
-        if (s && e)
+        if (s && e) {
             rep.replaceWith = string(s, e);
-        else
+            addSegment(rep.segments, rep.fileName, srcManager.getFileOffset(HashLoc), e - s);
+        } else {
             rep.replaceWith = "<Inliner error>\n";
+            addSegment(rep.segments, "", 0, rep.replaceWith.size());
+        }
         replacementStack.push_back(rep);
     }
 
@@ -116,12 +136,14 @@ public:
             if (!markAsIncluded(currentFile)) {
                 // - If current header should be skipped, set empty replacement
                 replacementStack[includedFrom].replaceWith = "";
+                replacementStack[includedFrom].segments.clear();
             } else if (isSystemHeader(PrevFID)) {
                 // - This is a new system header. Leave include directive as is,
                 //   i. e. do nothing.
             } else {
                 // - This is a new user header. Apply all replacements from current file.
-                replacementStack[includedFrom].replaceWith = calcReplacements(includedFrom, PrevFID);
+                calcReplacements(includedFrom, PrevFID, replacementStack[includedFrom].replaceWith,
+                                 replacementStack[includedFrom].segments);
             }
 
             // - Actually rewind.
@@ -130,7 +152,8 @@ public:
     }
 
     virtual void EndOfMainFile() override {
-        replacementStack[0].replaceWith = calcReplacements(0, srcManager.getMainFileID());
+        calcReplacements(0, srcManager.getMainFileID(), replacementStack[0].replaceWith,
+                         replacementStack[0].segments);
         replacementStack.resize(1);
     }
 
@@ -144,8 +167,10 @@ public:
             // It's important to do a manual check here because in other versions of STL
             // the header may not have been included. In other words, we need to explicitly
             // include every file that we use.
-            if (!markAsIncluded(SkippedFile))
+            if (!markAsIncluded(SkippedFile)) {
                 replacementStack.back().replaceWith = "";
+                replacementStack.back().segments.clear();
+            }
         }
     }
 
@@ -160,6 +185,7 @@ public:
 
 private:
     SourceManager& srcManager;
+    HeaderSearch& headerSearch;
 
     /*
      * Headers that have been included explicitly by user code (i.e. from a cpp file or from
@@ -167,6 +193,9 @@ private:
      */
     set<string>& includedHeaders;
 
+    // See Inliner::getShadowingPaths()
+    set<string>& shadowingPaths;
+
     /*
      * A 'stack' of replacements, reflecting current include stack.
      * Replacements in the same file are ordered by their location.
@@ -174,13 +203,31 @@ private:
      */
     vector<IncludeReplacement>& replacementStack;
 
+    const bool buildSegmentMap;
+
 private:
 
+    void addSegment(vector<InlinedSegment>& segments, const string& file,
+                    std::size_t fileOffset, std::size_t length) const
+    {
+        if (!buildSegmentMap || length == 0)
+            return;
+        InlinedSegment segment;
+        segment.file = file;
+        segment.fileOffset = fileOffset;
+        segment.length = length;
+        segments.push_back(std::move(segment));
+    }
+
     /*
      * Unwinds inclusion stack and calculates the result of inclusion of current file
      */
-    string calcReplacements(int includedFrom, FileID currentFID) const {
+    void calcReplacements(int includedFrom, FileID currentFID,
+                          string& resultText, vector<InlinedSegment>& resultSegments) const
+    {
         std::ostringstream result;
+        vector<InlinedSegment> segments;
+        const string currentFile = getCanonicalPath(srcManager.getFileEntryForID(currentFID));
         // We go over each #include directive in current file and replace it
         // with the result of inclusion.
         // The last value of i doesn't correspond to an include directive,
@@ -210,17 +257,58 @@ private:
                 const char* e = 0;
                 if (!invalid)
                     e = srcManager.getCharacterData(blockEnd, &invalid);
-                if (invalid || !b || !e)
+                if (invalid || !b || !e) {
                     result << "<Inliner error>\n";
-                else
+                    addSegment(segments, "", 0, std::strlen("<Inliner error>\n"));
+                } else {
                     result << string(b, e);
+                    addSegment(segments, currentFile, srcManager.getFileOffset(blockStart), e - b);
+                }
             }
 
             // Now output the result of file inclusion
-            if (i != int(replacementStack.size()))
+            if (i != int(replacementStack.size())) {
                 result << replacementStack[i].replaceWith;
+                segments.insert(segments.end(), replacementStack[i].segments.begin(),
+                                replacementStack[i].segments.end());
+            }
+        }
+        resultText = result.str();
+        resultSegments.swap(segments);
+    }
+
+    /*
+     * Records the paths where the header would have been found before the directory
+     * it was found in (SearchPath), in the order clang searches them.
+     */
+    void addShadowingPaths(SourceLocation hashLoc, StringRef fileName, bool isAngled,
+                           StringRef searchPath)
+    {
+        if (llvm::sys::path::is_absolute(fileName))
+            return;
+
+        vector<string> directories;
+        if (!isAngled) {
+            const FileEntry* includer = srcManager.getFileEntryForID(srcManager.getFileID(hashLoc));
+            if (includer)
+                directories.push_back(string(includer->getDir()->getName()));
+        }
+        auto it = isAngled ? headerSearch.angled_dir_begin() : headerSearch.quoted_dir_begin();
+        for (; it != headerSearch.search_dir_end(); ++it) {
+            // Frameworks and header maps are not tracked
+            if (const DirectoryEntry* dir = it->getDir())
+                directories.push_back(string(dir->getName()));
+        }
+
+        for (const string& directory : directories) {
+            if (directory == searchPath)
+                return;
+            llvm::SmallString<256> path(directory);
+            llvm::sys::path::append(path, fileName);
+            // The same directory may be spelled differently in the search path
+            if (!llvm::sys::fs::exists(path.str()))
+                shadowingPaths.insert(path.str());
         }
-        return result.str();
     }
 
     string getCanonicalPath(const FileEntry* entry) const {
@@ -266,20 +354,80 @@ class InlinerFrontendAction : public ASTFrontendAction {
 private:
     vector<IncludeReplacement>& replacementStack;
     set<string>& includedHeaders;
+    set<string>& shadowingPaths;
+    const DiagnosticsCollector& diagnostics;
+    const bool buildSegmentMap;
 
 public:
     InlinerFrontendAction(vector<IncludeReplacement>& _replacementStack,
-                          set<string>& _includedHeaders)
+                          set<string>& _includedHeaders,
+                          set<string>& _shadowingPaths,
+                          const DiagnosticsCollector& _diagnostics,
+                          bool _buildSegmentMap)
         : replacementStack(_replacementStack)
         , includedHeaders(_includedHeaders)
+        , shadowingPaths(_shadowingPaths)
+        , diagnostics(_diagnostics)
+        , buildSegmentMap(_buildSegmentMap)
     {}
 
     virtual std::unique_ptr<ASTConsumer> CreateASTConsumer(CompilerInstance& compiler, StringRef /*file*/) override
     {
-        compiler.getPreprocessor().addPPCallbacks(std::unique_ptr<TrackMacro>(new TrackMacro(
-                compiler.getSourceManager(), includedHeaders, replacementStack)));
+        Preprocessor& preprocessor = compiler.getPreprocessor();
+        preprocessor.addPPCallbacks(std::unique_ptr<TrackMacro>(new TrackMacro(
+                compiler.getSourceManager(), preprocessor.getHeaderSearchInfo(), includedHeaders,
+                shadowingPaths, replacementStack, buildSegmentMap)));
 
-        return std::unique_ptr<ASTConsumer>(new ASTConsumer());
+        return std::unique_ptr<ASTConsumer>(new ErrorLimitConsumer(diagnostics));
+    }
+};
+
+// Only runs the preprocessor, and doesn't enter system headers
+class OpaqueInlinerFrontendAction : public PreprocessOnlyAction {
+private:
+    vector<IncludeReplacement>& replacementStack;
+    set<string>& includedHeaders;
+    set<string>& shadowingPaths;
+    const DiagnosticsCollector& diagnostics;
+    const bool buildSegmentMap;
+    bool& dependsOnSystemMacros;
+    OpaqueSystemHeaders* opaqueSystemHeaders = nullptr;
+
+public:
+    OpaqueInlinerFrontendAction(vector<IncludeReplacement>& _replacementStack,
+                                set<string>& _includedHeaders,
+                                set<string>& _shadowingPaths,
+                                const DiagnosticsCollector& _diagnostics,
+                                bool _buildSegmentMap,
+                                bool& _dependsOnSystemMacros)
+        : replacementStack(_replacementStack)
+        , includedHeaders(_includedHeaders)
+        , shadowingPaths(_shadowingPaths)
+        , diagnostics(_diagnostics)
+        , buildSegmentMap(_buildSegmentMap)
+        , dependsOnSystemMacros(_dependsOnSystemMacros)
+    {}
+
+protected:
+    virtual void ExecuteAction() override {
+        CompilerInstance& compiler = getCompilerInstance();
+        Preprocessor& preprocessor = compiler.getPreprocessor();
+        preprocessor.addPPCallbacks(std::unique_ptr<TrackMacro>(new TrackMacro(
+                compiler.getSourceManager(), preprocessor.getHeaderSearchInfo(), includedHeaders,
+                shadowingPaths, replacementStack, buildSegmentMap)));
+        // Owned by the preprocessor, which is alive until the end of this function
+        opaqueSystemHeaders = new OpaqueSystemHeaders(preprocessor);
+        preprocessor.addPPCallbacks(std::unique_ptr<OpaqueSystemHeaders>(opaqueSystemHeaders));
+
+        // Same as PreprocessOnlyAction::ExecuteAction(), but stops at the error limit
+        preprocessor.IgnorePragmas();
+        preprocessor.EnterMainSourceFile();
+        Token token;
+        do {
+            preprocessor.Lex(token);
+        } while (token.isNot(tok::eof) && !diagnostics.errorLimitReached());
+
+        dependsOnSystemMacros = opaqueSystemHeaders->dependsOnSystemMacros();
     }
 };
 
@@ -287,45 +435,104 @@ class InlinerFrontendActionFactory: public tooling::FrontendActionFactory {
 private:
     vector<IncludeReplacement>& replacementStack;
     set<string>& includedHeaders;
+    set<string>& shadowingPaths;
+    const DiagnosticsCollector& diagnostics;
+    const bool buildSegmentMap;
+    // Not null in the opaque system headers mode
+    bool* dependsOnSystemMacros;
 
 public:
     InlinerFrontendActionFactory(vector<IncludeReplacement>& replacementStack_,
-                                 set<string>& includedHeaders_)
+                                 set<string>& includedHeaders_,
+                                 set<string>& shadowingPaths_,
+                                 const DiagnosticsCollector& diagnostics_,
+                                 bool buildSegmentMap_,
+                                 bool* dependsOnSystemMacros_)
         : replacementStack(replacementStack_)
         , includedHeaders(includedHeaders_)
+        , shadowingPaths(shadowingPaths_)
+        , diagnostics(diagnostics_)
+        , buildSegmentMap(buildSegmentMap_)
+        , dependsOnSystemMacros(dependsOnSystemMacros_)
     {}
     FrontendAction* create() {
-        return new InlinerFrontendAction(replacementStack, includedHeaders);
+        if (dependsOnSystemMacros) {
+            return new OpaqueInlinerFrontendAction(replacementStack, includedHeaders,
+                                                   shadowingPaths, diagnostics, buildSegmentMap,
+                                                   *dependsOnSystemMacros);
+        }
+        return new InlinerFrontendAction(replacementStack, includedHeaders, shadowingPaths,
+                                         diagnostics, buildSegmentMap);
     }
 };
 
 Inliner::Inliner(const vector<string>& cmdLineOptions_)
-    : cmdLineOptions(cmdLineOptions_)
+    : errorLimit(0)
+    , buildSegmentMap(false)
+    , opaqueSystemHeaders(false)
+    , cmdLineOptions(cmdLineOptions_)
 {}
 
 string Inliner::doInline(const string& cppFile) {
-    std::unique_ptr<clang::tooling::FixedCompilationDatabase> compilationDatabase(
-        createCompilationDatabaseFromCommandLine(cmdLineOptions));
-
-    vector<string> sources(1);
-    sources[0] = cppFile;
+    if (opaqueSystemHeaders) {
+        const set<string> includedHeadersBefore = includedHeaders;
+        bool dependsOnSystemMacros = true;
+        try {
+            string result = inlineFile(cppFile, &dependsOnSystemMacros);
+            if (!dependsOnSystemMacros)
+                return result;
+            inlineResults.pop_back();
+        } catch (const CompilationError&) {
+            // The error may be caused by a skipped system header (e.g. #error in user code
+            // depending on a system macro); the full run reports the real errors if any
+        }
+        includedHeaders = includedHeadersBefore;
+    }
+    return inlineFile(cppFile, nullptr);
+}
 
+string Inliner::inlineFile(const string& cppFile, bool* dependsOnSystemMacros) {
     vector<IncludeReplacement> replacementStack;
-    InlinerFrontendActionFactory factory(replacementStack, includedHeaders);
+    DiagnosticsCollector diagnosticsCollector(errorLimit);
+    InlinerFrontendActionFactory factory(replacementStack, includedHeaders, shadowingPaths,
+                                         diagnosticsCollector, buildSegmentMap,
+                                         dependsOnSystemMacros);
 
-    clang::tooling::ClangTool tool(*compilationDatabase, sources);
+    FrontendTool tool(cmdLineOptions, cppFile);
+    tool.setDiagnosticConsumer(&diagnosticsCollector);
 
     int ret = tool.run(&factory);
+    diagnostics = diagnosticsCollector.getDiagnostics();
 
     if (ret != 0)
-        throw std::runtime_error("Compilation error");
+        throw CompilationError(diagnostics);
     else if (replacementStack.size() != 1)
         throw std::logic_error("Caide inliner error");
 
     inlineResults.push_back(replacementStack[0].replaceWith);
+    segmentMap.swap(replacementStack[0].segments);
     return inlineResults.back();
 }
 
+const set<string>& Inliner::getIncludedHeaders() const {
+    return includedHeaders;
+}
+
+const vector<InlinedSegment>& Inliner::getSegmentMap() const {
+    return segmentMap;
+}
+
+const set<string>& Inliner::getShadowingPaths() const {
+    return shadowingPaths;
+}
+
+string getCurrentDirectory() {
+    llvm::SmallString<256> currentDirectory;
+    if (llvm::sys::fs::current_path(currentDirectory))
+        return "";
+    return currentDirectory.str();
+}
+
 }
 }
 
@@ -6,6 +6,9 @@
 
 #pragma once
 
+#include "caideInliner.hpp"
+
+#include <cstddef>
 #include <vector>
 #include <string>
 #include <set>
@@ -13,6 +16,14 @@
 namespace caide {
 namespace internal {
 
+// A part of the inliner output copied verbatim from a file
+struct InlinedSegment {
+    // Canonical path of the file; empty if the text doesn't come from a file
+    std::string file;
+    std::size_t fileOffset;
+    std::size_t length;
+};
+
 // First inliner stage: inline included headers
 class Inliner {
 public:
@@ -20,14 +31,51 @@ public:
 
     // The file is read in binary mode, so the returned string is also
     // 'in binary mode' (contains \r\n on Windows)
+    // Throws CompilationError if the file doesn't compile
     std::string doInline(const std::string& cppFile);
 
+    // See CppInliner::errorLimit
+    int errorLimit;
+
+    // Diagnostics reported in the last call to doInline()
+    std::vector<CompilationDiagnostic> diagnostics;
+
+    // Canonical paths of all headers included from user code (user headers and
+    // system headers included directly)
+    const std::set<std::string>& getIncludedHeaders() const;
+
+    // Whether doInline() should record the segment map of its result
+    bool buildSegmentMap;
+
+    // Segments that make up the result of the last call to doInline(), in order.
+    // Empty unless buildSegmentMap is set.
+    const std::vector<InlinedSegment>& getSegmentMap() const;
+
+    // Paths that were searched, and didn't exist, before the headers included from user code
+    // were found. If any of them is created, the same include directives may resolve to
+    // another header.
+    const std::set<std::string>& getShadowingPaths() const;
+
+    // Whether doInline() should try to only preprocess the code without entering system
+    // headers first (see OpaqueSystemHeaders). The result is the same either way.
+    bool opaqueSystemHeaders;
+
 private:
+    // dependsOnSystemMacros is null for a full compilation; otherwise, system headers
+    // are skipped, and it is set to true if the result may be incorrect because of that
+    std::string inlineFile(const std::string& cppFile, bool* dependsOnSystemMacros);
+
     std::vector<std::string> cmdLineOptions;
     std::set<std::string> includedHeaders;
+    std::set<std::string> shadowingPaths;
     std::vector<std::string> inlineResults;
+    std::vector<InlinedSegment> segmentMap;
 };
 
+// The directory that relative paths in clang options and include directives are resolved
+// against; empty if it can't be determined
+std::string getCurrentDirectory();
+
 }
 }
 
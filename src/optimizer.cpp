@@ -6,12 +6,17 @@
 
 #include "optimizer.h"
 #include "DependenciesCollector.h"
+#include "DiagnosticsCollector.h"
+#include "FrontendTool.h"
+#include "hash.h"
 #include "MergeNamespacesVisitor.h"
 #include "OptimizerVisitor.h"
+#include "ReachabilityExplainer.h"
 #include "RemoveInactivePreprocessorBlocks.h"
 #include "SmartRewriter.h"
 #include "SourceInfo.h"
 #include "util.h"
+#include "caide_probes.h"
 
 // #define CAIDE_DEBUG_MODE
 #include "caide_debug.h"
@@ -27,11 +32,16 @@
 #include <clang/Tooling/Tooling.h>
 
 
+#include <algorithm>
+#include <cstddef>
+#include <deque>
 #include <fstream>
 #include <memory>
 #include <set>
+#include <sstream>
 #include <stdexcept>
 #include <string>
+#include <unordered_map>
 #include <unordered_set>
 #include <vector>
 #include <iostream>
@@ -101,32 +111,77 @@ private:
     SourceInfo& srcInfo;
 };
 
+// Kept spans of the main buffer (the buffer itself is left empty), and the size and
+// the hash of the buffer as the compiler read it (see Optimizer::optimizeFile())
+struct OptimizerResult {
+    KeptSpans keptSpans;
+    std::size_t bufferSize = 0;
+    std::uint64_t bufferHash = 0;
+};
+
 class OptimizerConsumer: public ASTConsumer {
 public:
     OptimizerConsumer(CompilerInstance& compiler_, std::unique_ptr<SmartRewriter> smartRewriter_,
                 RemoveInactivePreprocessorBlocks& ppCallbacks_,
-                string& result_)
+                Optimizer& optimizer_,
+                const DiagnosticsCollector& diagnostics_,
+                OptimizerResult& result_)
         : compiler(compiler_)
         , sourceManager(compiler.getSourceManager())
         , smartRewriter(std::move(smartRewriter_))
         , ppCallbacks(ppCallbacks_)
+        , optimizer(optimizer_)
+        , diagnostics(diagnostics_)
         , result(result_)
-    {}
+    {
+        srcInfo.recordDependencyKinds = !optimizer.declarationsToExplain.empty();
+    }
+
+    virtual bool HandleTopLevelDecl(DeclGroupRef) override {
+        // Returning false stops the parser
+        return !diagnostics.errorLimitReached();
+    }
+
+    // Called only if FrontendOptions::SkipFunctionBodies is set. The body of a non-template
+    // function in a system header may only refer to declarations from system headers, so it
+    // can't make any user declaration reachable. Templates must be parsed: an instantiation
+    // may use user declarations (e.g. std::sort calls a user operator<). Sema doesn't skip
+    // bodies that may be needed later anyway (constexpr functions, deduced return types).
+    virtual bool shouldSkipFunctionBody(Decl* decl) override {
+        FunctionDecl* function = dyn_cast<FunctionDecl>(decl);
+        if (!function || function->isDependentContext() || function->getDescribedFunctionTemplate())
+            return false;
+        return sourceManager.isInSystemHeader(function->getLocation());
+    }
 
     virtual void HandleTranslationUnit(ASTContext& Ctx) override {
 #ifdef CAIDE_DEBUG_MODE
         Ctx.getTranslationUnitDecl()->dump();
 #endif
+        const std::uint64_t jobId = optimizer.jobId;
+
         // 0. Collect auxiliary information.
+        CAIDE_PROBE2(optimize__step__start, jobId, "nonImplicitDecls");
         {
             BuildNonImplicitDeclMap visitor(srcInfo);
             visitor.TraverseDecl(Ctx.getTranslationUnitDecl());
         }
+        CAIDE_PROBE3(optimize__step__end, jobId, "nonImplicitDecls",
+                     srcInfo.nonImplicitDecls.size());
 
         // 1. Build dependency graph for semantic declarations.
+        // In lazy mode, only the roots are found here, without traversing function bodies.
+        // The graph is built in step 2 as the search reaches it. Dumping and explaining need
+        // the whole graph.
+        const bool lazyGraph = optimizer.lazyDependencyGraph &&
+            optimizer.dependencyGraphFile.empty() && optimizer.declarationsToExplain.empty();
+        CAIDE_PROBE2(optimize__step__start, jobId, "dependencies");
+        DependenciesCollector depsVisitor(sourceManager, srcInfo);
         {
-            DependenciesCollector depsVisitor(sourceManager, srcInfo);
-            depsVisitor.TraverseDecl(Ctx.getTranslationUnitDecl());
+            if (lazyGraph)
+                depsVisitor.findMainFileRoots(Ctx.getTranslationUnitDecl());
+            else
+                depsVisitor.TraverseDecl(Ctx.getTranslationUnitDecl());
 
             // Source range of delayed-parsed template functions includes only declaration part.
             //     Force their parsing to get correct source ranges.
@@ -144,24 +199,57 @@ public:
             std::ofstream file("caide-graph.dot");
             depsVisitor.printGraph(file);
 #endif
+
+            if (!optimizer.dependencyGraphFile.empty()) {
+                std::ofstream graphFile(optimizer.dependencyGraphFile, std::ios::binary);
+                depsVisitor.writeBinaryGraph(graphFile);
+                graphFile.close();
+                // Exceptions must not propagate through clang
+                optimizer.dependencyGraphWriteFailed = !graphFile;
+            }
         }
+        CAIDE_PROBE3(optimize__step__end, jobId, "dependencies", srcInfo.uses.size());
 
         // 2. Find semantic declarations that are reachable from main function in the graph.
+        CAIDE_PROBE2(optimize__step__start, jobId, "reachability");
         std::unordered_set<Decl*> used;
         {
-            set<Decl*> queue;
-            for (Decl* decl : srcInfo.declsToKeep)
-                queue.insert(decl->getCanonicalDecl());
+            // Breadth-first search, so that reachedFrom describes shortest paths from the roots.
+            const bool explain = !optimizer.declarationsToExplain.empty();
+            std::unordered_map<Decl*, Decl*> reachedFrom;
+            std::deque<Decl*> queue;
+            for (Decl* decl : srcInfo.declsToKeep) {
+                if (used.insert(decl->getCanonicalDecl()).second)
+                    queue.push_back(decl->getCanonicalDecl());
+            }
 
             while (!queue.empty()) {
-                Decl* decl = *queue.begin();
-                queue.erase(queue.begin());
-                if (used.insert(decl).second)
-                    queue.insert(srcInfo.uses[decl].begin(), srcInfo.uses[decl].end());
+                Decl* decl = queue.front();
+                queue.pop_front();
+                if (lazyGraph)
+                    depsVisitor.collectDependenciesOf(decl);
+                auto it = srcInfo.uses.find(decl);
+                if (it == srcInfo.uses.end())
+                    continue;
+                for (Decl* dependency : it->second) {
+                    if (used.insert(dependency).second) {
+                        queue.push_back(dependency);
+                        if (explain)
+                            reachedFrom[dependency] = decl;
+                    }
+                }
+            }
+
+            if (explain) {
+                ReachabilityExplainer explainer(Ctx, srcInfo, used, reachedFrom);
+                optimizer.explanation = explainer.explain(optimizer.declarationsToExplain);
             }
         }
+        optimizer.traversedDeclarations = lazyGraph ? depsVisitor.getNumTraversedMainFileUnits() : 0;
+        CAIDE_PROBE3(optimize__step__end, jobId, "reachability", used.size());
 
         // 3. Remove unnecessary lexical declarations.
+        CAIDE_PROBE2(optimize__step__start, jobId, "removeDecls");
         std::unordered_set<Decl*> removedDecls;
         {
             OptimizerVisitor visitor(sourceManager, used, removedDecls, *smartRewriter);
@@ -172,6 +260,7 @@ public:
             MergeNamespacesVisitor visitor(sourceManager, removedDecls, *smartRewriter);
             visitor.TraverseDecl(Ctx.getTranslationUnitDecl());
         }
+        CAIDE_PROBE3(optimize__step__end, jobId, "removeDecls", removedDecls.size());
 
         // 4. Remove inactive preprocessor branches that have not yet been removed.
         // 5. Remove preprocessor definitions, all usages of which are inside removed code.
@@ -179,36 +268,52 @@ public:
         // Callbacks have been called implicitly before this method, so we only need to call
         // Finalize() method that will actually use the information collected by callbacks
         // to remove unused preprocessor code
+        CAIDE_PROBE2(optimize__step__start, jobId, "preprocessor");
         ppCallbacks.Finalize();
+        CAIDE_PROBE3(optimize__step__end, jobId, "preprocessor", 0);
 
         // 6. Remove comments
         //
         // Will only be able to catch every comment if -fparse-all-comments
         // is set.
+        CAIDE_PROBE2(optimize__step__start, jobId, "comments");
         {
           for (RawComment* comment : Ctx.getRawCommentList().getComments()) {
             smartRewriter->removeRange(comment->getSourceRange());
           }
         }
+        CAIDE_PROBE3(optimize__step__end, jobId, "comments",
+                     Ctx.getRawCommentList().getComments().size());
 
-        smartRewriter->applyChanges();
-
-        result = getResult();
+        // The output is built from the spans after all clang state has been released
+        CAIDE_PROBE2(optimize__step__start, jobId, "result");
+        result = getKeptSpans();
+        CAIDE_PROBE3(optimize__step__end, jobId, "result", result.keptSpans.spans.size());
     }
 
 private:
-    string getResult() const {
-        if (const RewriteBuffer* rewriteBuf =
-                smartRewriter->getRewriteBufferFor(sourceManager.getMainFileID()))
-            return string(rewriteBuf->begin(), rewriteBuf->end());
-
-        // No changes
-        bool invalid;
-        const llvm::MemoryBuffer* buf = sourceManager.getBuffer(sourceManager.getMainFileID(), &invalid);
-        if (buf && !invalid)
-            return string(buf->getBufferStart(), buf->getBufferEnd());
-        else
-            return "Inliner error"; // something's wrong
+    OptimizerResult getKeptSpans() const {
+        OptimizerResult res;
+        bool invalid = false;
+        StringRef buffer = sourceManager.getBufferData(sourceManager.getMainFileID(), &invalid);
+        if (invalid) {
+            res.keptSpans.buffer = "Inliner error"; // something's wrong
+            res.keptSpans.spans.push_back(TextSpan{0, res.keptSpans.buffer.size()});
+            return res;
+        }
+        res.bufferSize = buffer.size();
+        res.bufferHash = fnv1aHash(buffer.data(), buffer.size());
+
+        // Kept spans are the gaps between removed ranges
+        std::size_t keptBegin = 0;
+        for (const auto& removed : smartRewriter->getRemovedOffsets(sourceManager.getMainFileID())) {
+            if (keptBegin < removed.first)
+                res.keptSpans.spans.push_back(TextSpan{keptBegin, removed.first});
+            keptBegin = std::max<std::size_t>(keptBegin, removed.second);
+        }
+        if (keptBegin < buffer.size())
+            res.keptSpans.spans.push_back(TextSpan{keptBegin, buffer.size()});
+        return res;
     }
 
 private:
@@ -216,31 +321,41 @@ private:
     SourceManager& sourceManager;
     std::unique_ptr<SmartRewriter> smartRewriter;
     RemoveInactivePreprocessorBlocks& ppCallbacks;
-    string& result;
+    Optimizer& optimizer;
+    const DiagnosticsCollector& diagnostics;
+    OptimizerResult& result;
     SourceInfo srcInfo;
 };
 
 
 class OptimizerFrontendAction : public ASTFrontendAction {
 private:
-    string& result;
+    OptimizerResult& result;
     const set<string>& macrosToKeep;
+    Optimizer& optimizer;
+    const DiagnosticsCollector& diagnostics;
 public:
-    OptimizerFrontendAction(string& result_, const set<string>& macrosToKeep_)
+    OptimizerFrontendAction(OptimizerResult& result_, const set<string>& macrosToKeep_,
+                            Optimizer& optimizer_, const DiagnosticsCollector& diagnostics_)
         : result(result_)
         , macrosToKeep(macrosToKeep_)
+        , optimizer(optimizer_)
+        , diagnostics(diagnostics_)
     {}
 
     virtual std::unique_ptr<ASTConsumer> CreateASTConsumer(CompilerInstance& compiler, StringRef /*file*/) override
     {
         if (!compiler.hasSourceManager())
             throw "No source manager";
+        // The parser is created after the consumer
+        compiler.getFrontendOpts().SkipFunctionBodies = optimizer.skipSystemFunctionBodies;
         auto smartRewriter = std::unique_ptr<SmartRewriter>(
             new SmartRewriter(compiler.getSourceManager(), compiler.getLangOpts()));
         auto ppCallbacks = std::unique_ptr<RemoveInactivePreprocessorBlocks>(
             new RemoveInactivePreprocessorBlocks(compiler.getSourceManager(), *smartRewriter, macrosToKeep));
         auto consumer = std::unique_ptr<OptimizerConsumer>(
-            new OptimizerConsumer(compiler, std::move(smartRewriter), *ppCallbacks, result));
+            new OptimizerConsumer(compiler, std::move(smartRewriter), *ppCallbacks,
+                                  optimizer, diagnostics, result));
         compiler.getPreprocessor().addPPCallbacks(std::move(ppCallbacks));
         return std::move(consumer);
     }
@@ -248,44 +363,132 @@ public:
 
 class OptimizerFrontendActionFactory: public tooling::FrontendActionFactory {
 private:
-    string& result;
+    OptimizerResult& result;
     const set<string>& macrosToKeep;
+    Optimizer& optimizer;
+    const DiagnosticsCollector& diagnostics;
 public:
-    OptimizerFrontendActionFactory(string& result_, const set<string>& macrosToKeep_)
+    OptimizerFrontendActionFactory(OptimizerResult& result_, const set<string>& macrosToKeep_,
+                                   Optimizer& optimizer_, const DiagnosticsCollector& diagnostics_)
         : result(result_)
         , macrosToKeep(macrosToKeep_)
+        , optimizer(optimizer_)
+        , diagnostics(diagnostics_)
+    {}
+    FrontendAction* create() {
+        return new OptimizerFrontendAction(result, macrosToKeep, optimizer, diagnostics);
+    }
+};
+
+
+class VerifierFrontendAction : public ASTFrontendAction {
+private:
+    const DiagnosticsCollector& diagnostics;
+public:
+    explicit VerifierFrontendAction(const DiagnosticsCollector& diagnostics_)
+        : diagnostics(diagnostics_)
+    {}
+
+    virtual std::unique_ptr<ASTConsumer> CreateASTConsumer(CompilerInstance&, StringRef /*file*/) override
+    {
+        return std::unique_ptr<ASTConsumer>(new ErrorLimitConsumer(diagnostics));
+    }
+};
+
+class VerifierFrontendActionFactory: public tooling::FrontendActionFactory {
+private:
+    const DiagnosticsCollector& diagnostics;
+public:
+    explicit VerifierFrontendActionFactory(const DiagnosticsCollector& diagnostics_)
+        : diagnostics(diagnostics_)
     {}
     FrontendAction* create() {
-        return new OptimizerFrontendAction(result, macrosToKeep);
+        return new VerifierFrontendAction(diagnostics);
     }
 };
 
 
 Optimizer::Optimizer(const vector<string>& cmdLineOptions_,
                      const vector<string>& macrosToKeep_)
-    : cmdLineOptions(cmdLineOptions_)
+    : errorLimit(0)
+    , skipSystemFunctionBodies(false)
+    , lazyDependencyGraph(false)
+    , traversedDeclarations(0)
+    , jobId(0)
+    , dependencyGraphWriteFailed(false)
+    , cmdLineOptions(cmdLineOptions_)
     , macrosToKeep(macrosToKeep_.begin(), macrosToKeep_.end())
 {}
 
-string Optimizer::doOptimize(const string& cppFile) {
-    std::unique_ptr<tooling::FixedCompilationDatabase> compilationDatabase(
-        createCompilationDatabaseFromCommandLine(cmdLineOptions));
+Optimizer::~Optimizer() = default;
 
-    vector<string> sources;
-    sources.push_back(cppFile);
+KeptSpans Optimizer::doOptimize(const string& cppFile) {
+    if (skipSystemFunctionBodies) {
+        try {
+            return optimizeFile(cppFile);
+        } catch (const CompilationError&) {
+            // Possibly caused by a skipped body; the full run reports the real errors if any
+        }
+        skipSystemFunctionBodies = false;
+        explanation.clear();
+        KeptSpans result = optimizeFile(cppFile);
+        skipSystemFunctionBodies = true;
+        return result;
+    }
+    return optimizeFile(cppFile);
+}
 
-    clang::tooling::ClangTool tool(*compilationDatabase, sources);
+KeptSpans Optimizer::optimizeFile(const string& cppFile) {
+    tool.reset(new FrontendTool(cmdLineOptions, cppFile));
+    optimizedFile = cppFile;
 
-    string result;
-    OptimizerFrontendActionFactory factory(result, macrosToKeep);
+    OptimizerResult result;
+    DiagnosticsCollector diagnosticsCollector(errorLimit);
+    OptimizerFrontendActionFactory factory(result, macrosToKeep, *this, diagnosticsCollector);
+    tool->setDiagnosticConsumer(&diagnosticsCollector);
 
-    int ret = tool.run(&factory);
+    dependencyGraphWriteFailed = false;
+    int ret = tool->run(&factory);
+    tool->setDiagnosticConsumer(nullptr);
     if (ret != 0)
-        throw std::runtime_error("Compilation error");
+        throw CompilationError(diagnosticsCollector.getDiagnostics());
+    if (dependencyGraphWriteFailed)
+        throw std::runtime_error("Couldn't write the dependency graph to " + dependencyGraphFile);
+    diagnostics = diagnosticsCollector.getDiagnostics();
+
+    // The AST, the preprocessor and the source manager are gone by now, so that the peak
+    // memory is the AST or the output, not both. Kept spans refer to the file as the compiler
+    // read it, which is checked by its size and hash.
+    KeptSpans& keptSpans = result.keptSpans;
+    if (keptSpans.buffer.empty()) {
+        std::ifstream in(cppFile, std::ios::binary);
+        std::ostringstream contents;
+        contents << in.rdbuf();
+        keptSpans.buffer = contents.str();
+        if (keptSpans.buffer.size() != result.bufferSize ||
+                fnv1aHash(keptSpans.buffer) != result.bufferHash)
+            throw std::runtime_error("File changed during optimization: " + cppFile);
+    }
 
-    return result;
+    return std::move(keptSpans);
 }
 
-}
+vector<CompilationDiagnostic> Optimizer::verify(const string& code) {
+    if (!tool)
+        throw std::logic_error("Optimizer::verify() called before doOptimize()");
+
+    // The tool has a single source file. Remapping it makes the compiler read the new
+    // contents, while the headers are served from the file manager of the previous run.
+    tool->mapVirtualFile(optimizedFile, code);
+
+    DiagnosticsCollector diagnosticsCollector(errorLimit);
+    VerifierFrontendActionFactory factory(diagnosticsCollector);
+    tool->setDiagnosticConsumer(&diagnosticsCollector);
+    tool->run(&factory);
+    tool->setDiagnosticConsumer(nullptr);
+
+    return diagnosticsCollector.getDiagnostics();
 }
 
+}
+}
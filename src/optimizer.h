@@ -6,6 +6,11 @@
 
 #pragma once
 
+#include "caideInliner.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
 #include <vector>
 #include <set>
 #include <string>
@@ -13,19 +18,68 @@
 namespace caide {
 namespace internal {
 
+class FrontendTool;
+
 // Second inliner stage: remove unused code
 class Optimizer {
 public:
     Optimizer(const std::vector<std::string>& cmdLineOptions,
               const std::vector<std::string>& macrosToKeep);
+    ~Optimizer();
+
+    // Returns the contents of the file and the parts of it that are kept (suffix is empty).
+    // The file is read in binary mode, so the returned buffer is also
+    // 'in binary mode' (contains \r\n on Windows). The contents are read after the compiler
+    // state has been released; std::runtime_error is thrown if they differ from what
+    // the compiler read.
+    // Throws CompilationError if the file doesn't compile
+    KeptSpans doOptimize(const std::string& cppFile);
+
+    // Checks that code compiles, as if it were the contents of the file passed to doOptimize()
+    // (which must have been called before). The file manager of the optimizer is reused, so
+    // headers are not looked up and read from disk again. May be called at most once after
+    // each call to doOptimize().
+    std::vector<CompilationDiagnostic> verify(const std::string& code);
+
+    // See CppInliner::errorLimit
+    int errorLimit;
+
+    // Whether to skip bodies of non-template functions in system headers. If compilation fails
+    // in this mode, doOptimize() compiles the file again with all bodies.
+    bool skipSystemFunctionBodies;
 
-    // The file is read in binary mode, so the returned string is also
-    // 'in binary mode' (contains \r\n on Windows)
-    std::string doOptimize(const std::string& cppFile);
+    // Whether to build the dependency graph starting from its roots, traversing a declaration
+    // only when it is reached
+    bool lazyDependencyGraph;
+    // Set by doOptimize() in lazy mode: the number of traversed declarations at namespace scope
+    // of the main file
+    std::size_t traversedDeclarations;
+
+    // Passed to tracing probes
+    std::uint64_t jobId;
+
+    // If not empty, the dependency graph is written to this file in binary format
+    // (see GraphFormat.h).
+    std::string dependencyGraphFile;
+    // Set by doOptimize() if the dependency graph couldn't be written
+    bool dependencyGraphWriteFailed;
+
+    // Diagnostics (warnings) reported in the last successful call to doOptimize()
+    std::vector<CompilationDiagnostic> diagnostics;
+
+    // Declarations (names or file:line in cppFile) for which doOptimize() explains why they
+    // are kept. The explanation is stored in the explanation member.
+    std::vector<std::string> declarationsToExplain;
+    std::string explanation;
 
 private:
+    KeptSpans optimizeFile(const std::string& cppFile);
+
     std::vector<std::string> cmdLineOptions;
     std::set<std::string> macrosToKeep;
+
+    std::unique_ptr<FrontendTool> tool;
+    std::string optimizedFile;
 };
 
 }
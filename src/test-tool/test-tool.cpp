@@ -4,11 +4,13 @@
 // the Free Software Foundation, either version 3 of the License, or (at your
 // option) any later version. See LICENSE.TXT for details.
 
+#include "../caideInliner.h"
 #include "../caideInliner.hpp"
 
 #include <algorithm>
 #include <fstream>
 #include <iostream>
+#include <iterator>
 #include <sstream>
 #include <stdexcept>
 #include <string>
@@ -37,7 +39,185 @@ static string pathConcat(const string& directory, const string& fileName) {
     return directory + "/" + fileName;
 }
 
-static bool runTest(const string& testDirectory, const string& tempDirectory) {
+// Each line of the expected file must be a part of a line of text, in the same order
+static bool containsLines(const string& text, const string& expectedFilePath) {
+    const vector<string> expected = readNonEmptyLines(expectedFilePath);
+    std::istringstream in{text};
+    string line;
+    size_t i = 0;
+    while (i < expected.size() && std::getline(in, line)) {
+        if (line.find(expected[i]) != string::npos)
+            ++i;
+    }
+    if (i < expected.size()) {
+        std::cout << "Not found: " << expected[i] << "\n" << "In:\n" << text << "\n";
+        return false;
+    }
+    return true;
+}
+
+// The most expensive declaration must be the first one in the expected file, and the other
+// declarations of the file must follow in the report in the same order
+static bool checkCompileCost(const string& report, const string& expectedFilePath) {
+    const vector<string> expected = readNonEmptyLines(expectedFilePath);
+    std::istringstream in{report};
+    string line;
+    while (std::getline(in, line) && line.find("Most expensive declarations") == string::npos)
+        ;
+    if (!std::getline(in, line) || expected.empty() || line.find(expected[0]) == string::npos) {
+        std::cout << "The most expensive declaration is not " << (expected.empty() ? "" : expected[0])
+                  << "\n" << report << "\n";
+        return false;
+    }
+    size_t i = 1;
+    while (i < expected.size() && std::getline(in, line)) {
+        if (line.find(expected[i]) != string::npos)
+            ++i;
+    }
+    if (i < expected.size()) {
+        std::cout << "Not ranked as expected: " << expected[i] << "\n" << report << "\n";
+        return false;
+    }
+    return true;
+}
+
+// Each line of the expected file is a stage name followed by `executed` or `skipped`
+static bool checkStages(const vector<caide::StageStatistics>& stages, const string& expectedFilePath) {
+    for (const string& line : readNonEmptyLines(expectedFilePath)) {
+        std::istringstream in{line};
+        string name, state;
+        in >> name >> state;
+        auto it = std::find_if(stages.begin(), stages.end(),
+            [&](const caide::StageStatistics& stage) { return stage.name == name; });
+        if (it == stages.end() || it->executed != (state == "executed")) {
+            std::cout << "Stage " << name << " is not " << state << "\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+// In lazy mode, the expected file holds the number of traversed declarations at namespace scope
+// of the program (instantiations included), so that unreached ones are known not to be traversed
+static bool checkTraversedDeclarations(const caide::InlinerResult& result,
+                                       const string& expectedFilePath)
+{
+    const vector<string> lines = readNonEmptyLines(expectedFilePath);
+    if (lines.empty())
+        return true;
+    if (std::to_string(result.traversedDeclarations) != lines[0]) {
+        std::cout << result.traversedDeclarations << " declarations traversed instead of "
+                  << lines[0] << "\n";
+        return false;
+    }
+    return true;
+}
+
+static bool outputCompiles(const caide::InlinerResult& result) {
+    for (const caide::CompilationDiagnostic& diagnostic : result.verificationDiagnostics) {
+        if (diagnostic.severity == caide::CompilationDiagnostic::Severity::Error ||
+                diagnostic.severity == caide::CompilationDiagnostic::Severity::Fatal) {
+            std::cout << "Output doesn't compile: " << diagnostic.file << ":" << diagnostic.line
+                      << ":" << diagnostic.column << ": " << diagnostic.message << "\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool compareWithEtalon(const string& outputFilePath, const string& etalonFilePath) {
+    const vector<string> output = readNonEmptyLines(outputFilePath);
+    const vector<string> etalon = readNonEmptyLines(etalonFilePath);
+
+    const int minLength = (int)std::min(output.size(), etalon.size());
+    for (int i = 0; i < minLength; ++i) {
+        if (output[i] != etalon[i]) {
+            std::cout
+                << "< " << etalon[i] << "\n"
+                << "> " << output[i] << "\n";
+            return false;
+        }
+    }
+
+    if (output.size() < etalon.size()) {
+        std::cout << "Unexpected end of file: " << outputFilePath << "\n";
+        return false;
+    }
+
+    if (output.size() > etalon.size()) {
+        std::cout << "Unexpected end of file: " << etalonFilePath << "\n";
+        return false;
+    }
+
+    return true;
+}
+
+static const char* severityName(CaideDiagnosticSeverity severity) {
+    switch (severity) {
+    case CAIDE_DIAGNOSTIC_NOTE:
+        return "note";
+    case CAIDE_DIAGNOSTIC_WARNING:
+        return "warning";
+    case CAIDE_DIAGNOSTIC_ERROR:
+        return "error";
+    case CAIDE_DIAGNOSTIC_FATAL:
+        return "fatal error";
+    }
+    return "unknown";
+}
+
+// Runs the inliner through the C interface. Diagnostics must contain the lines of the expected
+// file; the run must fail iff there is no etalon.
+static bool runThroughCInterface(const string& tempDirectory, const caide::CppInliner& inliner,
+                                 const vector<string>& cppFiles,
+                                 const string& outputFilePath, const string& expectedFilePath,
+                                 bool expectSuccess)
+{
+    vector<const char*> clangOptions;
+    for (const string& s : inliner.clangCompilationOptions)
+        clangOptions.push_back(s.c_str());
+    vector<const char*> macrosToKeep;
+    for (const string& s : inliner.macrosToKeep)
+        macrosToKeep.push_back(s.c_str());
+    vector<const char*> files;
+    for (const string& s : cppFiles)
+        files.push_back(s.c_str());
+
+    CaideCppInlinerOptions options;
+    options.temporaryDirectory = tempDirectory.c_str();
+    options.clangCompilationOptions = clangOptions.data();
+    options.numClangOptions = (int)clangOptions.size();
+    options.macrosToKeep = macrosToKeep.data();
+    options.numMacrosToKeep = (int)macrosToKeep.size();
+    options.maxConsequentEmptyLines = inliner.maxConsequentEmptyLines;
+
+    CaideDiagnostic* diagnostics = nullptr;
+    int numDiagnostics = 0;
+    const int ret = caideInlineCppCodeWithDiagnostics(&options, 0, files.data(), (int)files.size(),
+        outputFilePath.c_str(), &diagnostics, &numDiagnostics);
+
+    std::ostringstream text;
+    for (int i = 0; i < numDiagnostics; ++i)
+        text << severityName(diagnostics[i].severity) << ": " << diagnostics[i].message << "\n";
+    caideFreeDiagnostics(diagnostics, numDiagnostics);
+
+    if (ret != (expectSuccess ? 0 : 1)) {
+        std::cout << "Unexpected return code " << ret << "\n" << text.str() << "\n";
+        return false;
+    }
+
+    return containsLines(text.str(), expectedFilePath);
+}
+
+struct TestOptions {
+    bool opaqueSystemHeaders = false;
+    bool skipSystemFunctionBodies = false;
+    bool lazyDependencyGraph = false;
+};
+
+static bool runTest(const string& testDirectory, const string& tempDirectory,
+                    const TestOptions& testOptions)
+{
     // Setup
     vector<string> cppFiles = readNonEmptyLines(pathConcat(testDirectory, "fileList.txt"));
     for (string& s : cppFiles)
@@ -79,51 +259,103 @@ static bool runTest(const string& testDirectory, const string& tempDirectory) {
     inliner.macrosToKeep = readNonEmptyLines(pathConcat(testDirectory, "macrosToKeep.txt"));
 
     const string outputFilePath = pathConcat(tempDirectory, "result.cpp");
-
-    // Run
-    inliner.inlineCode(cppFiles, outputFilePath);
-
-    // Assert
     const string etalonFilePath = pathConcat(testDirectory, "etalon.cpp");
-    const vector<string> output = readNonEmptyLines(outputFilePath);
-    const vector<string> etalon = readNonEmptyLines(etalonFilePath);
 
-    const int minLength = (int)std::min(output.size(), etalon.size());
-    for (int i = 0; i < minLength; ++i) {
-        if (output[i] != etalon[i]) {
-            std::cout
-                << "< " << etalon[i] << "\n"
-                << "> " << output[i] << "\n";
+    const string diagnosticsFilePath = pathConcat(testDirectory, "diagnostics.txt");
+    if (ifstream{diagnosticsFilePath.c_str()}) {
+        const bool expectSuccess = static_cast<bool>(ifstream{etalonFilePath.c_str()});
+        if (!runThroughCInterface(tempDirectory, inliner, cppFiles, outputFilePath,
+                                  diagnosticsFilePath, expectSuccess))
             return false;
+        return !expectSuccess || compareWithEtalon(outputFilePath, etalonFilePath);
+    }
+
+    // Run
+    inliner.verifyOutput = true;
+    inliner.opaqueSystemHeaders = testOptions.opaqueSystemHeaders;
+    inliner.skipSystemFunctionBodies = testOptions.skipSystemFunctionBodies;
+    inliner.lazyDependencyGraph = testOptions.lazyDependencyGraph;
+    inliner.declarationsToExplain = readNonEmptyLines(pathConcat(testDirectory, "explain.txt"));
+    const string compileCostFilePath = pathConcat(testDirectory, "compileCost.txt");
+    inliner.analyzeCompileCost = static_cast<bool>(ifstream{compileCostFilePath.c_str()});
+
+    // Each line of variants.txt holds the additional options of a configuration;
+    // etalon.<N>.cpp is the expected output of configuration N
+    const vector<string> variants = readNonEmptyLines(pathConcat(testDirectory, "variants.txt"));
+    if (!variants.empty()) {
+        vector<vector<string>> optionVariants;
+        for (const string& variant : variants) {
+            std::istringstream in{variant};
+            optionVariants.emplace_back(std::istream_iterator<string>{in},
+                                        std::istream_iterator<string>{});
         }
+        vector<caide::VariantOutput> outputs = inliner.inlineCodeVariants(cppFiles, optionVariants);
+        for (std::size_t i = 0; i < outputs.size(); ++i) {
+            const string index = std::to_string(i);
+            const string variantOutputFilePath = pathConcat(tempDirectory, "result." + index + ".cpp");
+            {
+                std::ofstream out{variantOutputFilePath.c_str(), std::ios::binary};
+                caide::writeKeptSpans(outputs[i].output, out);
+            }
+            if (!outputCompiles(outputs[i].result) ||
+                    !compareWithEtalon(variantOutputFilePath,
+                                       pathConcat(testDirectory, "etalon." + index + ".cpp")))
+                return false;
+        }
+        return true;
     }
 
-    if (output.size() < etalon.size()) {
-        std::cout << "Unexpected end of file: " << outputFilePath << "\n";
+    caide::InlinerResult result = inliner.inlineCode(cppFiles, outputFilePath);
+
+    if (!checkStages(result.stages, pathConcat(testDirectory, "expectedStages.txt")))
         return false;
-    }
 
-    if (output.size() > etalon.size()) {
-        std::cout << "Unexpected end of file: " << etalonFilePath << "\n";
+    if (inliner.lazyDependencyGraph && !checkTraversedDeclarations(result,
+            pathConcat(testDirectory, "traversedDeclarations.txt")))
         return false;
-    }
 
-    return true;
+    if (inliner.analyzeCompileCost && !checkCompileCost(result.compileCostReport, compileCostFilePath))
+        return false;
+
+    if (!inliner.declarationsToExplain.empty() &&
+            !containsLines(result.explanation, pathConcat(testDirectory, "explanation.txt")))
+        return false;
+
+    if (!outputCompiles(result))
+        return false;
+
+    // Assert
+    return compareWithEtalon(outputFilePath, etalonFilePath);
 }
 
 
 int main(int argc, char* argv[]) {
-    if (argc < 2) {
-        std::cout << "Usage: test-tool <temp-directory> [<test-directory>...]\n";
+    // Fast modes must produce the same output as the full run
+    TestOptions testOptions;
+    int i = 1;
+    for (; i < argc; ++i) {
+        if (string("--opaque-system-headers") == argv[i])
+            testOptions.opaqueSystemHeaders = true;
+        else if (string("--skip-system-function-bodies") == argv[i])
+            testOptions.skipSystemFunctionBodies = true;
+        else if (string("--lazy-dependency-graph") == argv[i])
+            testOptions.lazyDependencyGraph = true;
+        else
+            break;
+    }
+
+    if (i >= argc) {
+        std::cout << "Usage: test-tool [--opaque-system-headers] [--skip-system-function-bodies] "
+                     "[--lazy-dependency-graph] <temp-directory> [<test-directory>...]\n";
         return 1;
     }
 
-    const string tempDirectory{argv[1]};
+    const string tempDirectory{argv[i]};
 
     int numFailedTests = 0;
-    for (int i = 2; i < argc; ++i) {
+    for (++i; i < argc; ++i) {
         try {
-            if (!runTest(argv[i], tempDirectory)) {
+            if (!runTest(argv[i], tempDirectory, testOptions)) {
                 ++numFailedTests;
             }
         } catch (const std::exception& e) {
@@ -0,0 +1,51 @@
+#include "../caidePackedOutput.hpp"
+
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+
+using namespace std;
+
+static void usage() {
+    cerr << "Usage:\n"
+         << "  caide-unpack <container> list\n"
+         << "  caide-unpack <container> get <job id>\n";
+}
+
+int main(int argc, const char* argv[]) {
+    if (argc < 3) {
+        usage();
+        return 1;
+    }
+
+    try {
+        caide::PackedOutputReader reader(argv[1]);
+        const string command = argv[2];
+        if (command == "list") {
+            cout << "job\tstatus\tlength\tmicroseconds\thash\n";
+            for (size_t i = 0; i < reader.size(); ++i) {
+                const caide::PackedOutputEntry& entry = reader.entry(i);
+                cout << entry.jobId << '\t' << entry.status << '\t' << entry.length << '\t'
+                     << entry.elapsedMicroseconds << '\t' << hex << entry.contentHash << dec << '\n';
+            }
+        } else if (command == "get" && argc > 3) {
+            size_t i = reader.find(strtoull(argv[3], nullptr, 10));
+            if (i == caide::PackedOutputReader::npos) {
+                cerr << "Job not found: " << argv[3] << endl;
+                return 1;
+            }
+            cout.write(reader.data(i), reader.entry(i).length);
+            return reader.entry(i).status == 0 ? 0 : 2;
+        } else {
+            usage();
+            return 1;
+        }
+    } catch (const exception& e) {
+        cerr << e.what() << endl;
+        return 1;
+    }
+
+    return 0;
+}
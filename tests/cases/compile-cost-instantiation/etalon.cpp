@@ -0,0 +1,31 @@
+int cheap() { return 1; }
+
+template<int N>
+int heavy() {
+    int sum = 0;
+    for (int i = 0; i < N; ++i)
+        sum += i * N;
+    return sum + heavy<N - 1>();
+}
+
+template<>
+int heavy<0>() {
+    return 0;
+}
+
+template<int N>
+int light() {
+    int sum = 0;
+    for (int i = 0; i < N; ++i)
+        sum += i * N;
+    return sum + light<N - 1>();
+}
+
+template<>
+int light<0>() {
+    return 0;
+}
+
+int main() {
+    return cheap() + heavy<700>() + light<60>();
+}
@@ -0,0 +1,8 @@
+int f(int x) {
+    if (x)
+        return 1;
+}
+
+int main() {
+    return f(1);
+}
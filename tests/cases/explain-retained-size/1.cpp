@@ -0,0 +1,7 @@
+int unusedFunction() { return 0; }
+int bigHelper() { return 42; }
+int big() { return bigHelper(); }
+int shared() { return 1; }
+int a() { return shared(); }
+int b() { return shared(); }
+int main() { return big() + a() + b(); }
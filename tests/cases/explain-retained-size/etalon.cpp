@@ -0,0 +1,6 @@
+int bigHelper() { return 42; }
+int big() { return bigHelper(); }
+int shared() { return 1; }
+int a() { return shared(); }
+int b() { return shared(); }
+int main() { return big() + a() + b(); }
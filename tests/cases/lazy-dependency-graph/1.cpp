@@ -0,0 +1,37 @@
+template <typename T>
+T twice(T x) {
+    return x + x;
+}
+
+template <typename T>
+struct Unused {
+    T value;
+    T get() const { return twice(value); }
+};
+
+struct Helper {
+    int get() const;
+};
+
+int Helper::get() const {
+    return 3;
+}
+
+int unusedFunction() {
+    Unused<double> u;
+    Helper h;
+    return (int)u.get() + h.get() + twice(1L);
+}
+
+int used(int x) {
+    return x + 1;
+}
+
+/// caide keep
+int kept() {
+    return 2;
+}
+
+int main() {
+    return used(0) + twice(1);
+}
@@ -0,0 +1,17 @@
+template <typename T>
+T twice(T x) {
+    return x + x;
+}
+
+int used(int x) {
+    return x + 1;
+}
+
+/// caide keep
+int kept() {
+    return 2;
+}
+
+int main() {
+    return used(0) + twice(1);
+}
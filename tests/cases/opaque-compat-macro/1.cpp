@@ -0,0 +1,13 @@
+#include <climits>
+#include <cstdio>
+
+#ifndef INT_MAX
+#define INT_MAX
+#include "compat.h"
+#else
+#include "native.h"
+#endif
+
+int main() {
+    std::printf("%d\n", f());
+}
@@ -0,0 +1,6 @@
+#include <climits>
+#include <cstdio>
+inline int f() { return 1; }
+int main() {
+    std::printf("%d\n", f());
+}
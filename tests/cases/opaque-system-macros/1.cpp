@@ -0,0 +1,16 @@
+#include <climits>
+#include <cstdio>
+
+#ifdef LOCAL
+#include "debug.h"
+#endif
+
+#if INT_MAX > 0
+#include "a.h"
+#else
+#include "b.h"
+#endif
+
+int main() {
+    std::printf("%d\n", f());
+}
@@ -0,0 +1 @@
+inline int f() { return 1; }
@@ -0,0 +1 @@
+inline int debugOnly() { return 0; }
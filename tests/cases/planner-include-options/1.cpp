@@ -0,0 +1,7 @@
+#include <lib.h>
+
+int unused() { return 2; }
+
+int main() {
+    return twice(1);
+}
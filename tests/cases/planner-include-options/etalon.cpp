@@ -0,0 +1,4 @@
+#include <lib.h>
+int main() {
+    return twice(1);
+}
@@ -0,0 +1,8 @@
+_Pragma("once")
+int f() { return 1; }
+
+int unused() { return 2; }
+
+int main() {
+    return f();
+}
@@ -0,0 +1,7 @@
+#include <cstdio>
+
+void unused() {}
+
+int main() {
+    std::printf("%d\n", 1);
+}
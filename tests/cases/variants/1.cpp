@@ -0,0 +1,7 @@
+int a() { return 1; }
+
+int b() { return 2; }
+
+int main() {
+    return VALUE();
+}
@@ -0,0 +1,4 @@
+int a() { return 1; }
+int main() {
+    return VALUE();
+}
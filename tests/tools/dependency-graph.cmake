@@ -0,0 +1,73 @@
+# Checks the dependency graph written by `cmd -g` through queries of caide-graph,
+# that it is reproducible, and that damaged graph files are rejected.
+#
+# Usage: cmake -DCMD=<cmd> -DGRAPH=<caide-graph> -DTEMP_DIR=<dir> -P dependency-graph.cmake
+
+set(work_dir "${TEMP_DIR}/dependency-graph")
+file(REMOVE_RECURSE "${work_dir}")
+file(MAKE_DIRECTORY "${work_dir}")
+
+file(WRITE "${work_dir}/main.cpp" "
+int unusedFunction() { return 0; }
+int helper() { return 1; }
+int main() { return helper(); }
+")
+
+function(run_checked)
+    execute_process(COMMAND ${ARGN} RESULT_VARIABLE result OUTPUT_VARIABLE output)
+    if(NOT result EQUAL 0)
+        message(FATAL_ERROR "Failed (${result}): ${ARGN}")
+    endif()
+    set(output "${output}" PARENT_SCOPE)
+endfunction()
+
+set(graph "${work_dir}/graph.bin")
+run_checked("${CMD}" -- -d "${work_dir}" -o "${work_dir}/result.cpp" -g "${graph}"
+    "${work_dir}/main.cpp")
+
+# The same input produces the same file
+run_checked("${CMD}" -- -d "${work_dir}" -o "${work_dir}/result.cpp" -g "${work_dir}/graph2.bin"
+    "${work_dir}/main.cpp")
+file(READ "${graph}" graph_contents HEX)
+file(READ "${work_dir}/graph2.bin" graph2_contents HEX)
+if(NOT graph_contents STREQUAL graph2_contents)
+    message(FATAL_ERROR "Graph files of the same input differ")
+endif()
+
+run_checked("${GRAPH}" "${graph}" summary)
+if(NOT output MATCHES "nodes in main file: [1-9]")
+    message(FATAL_ERROR "Unexpected summary:\n${output}")
+endif()
+
+run_checked("${GRAPH}" "${graph}" reach)
+if(NOT output MATCHES "Function main <" OR NOT output MATCHES "Function helper <" OR
+        output MATCHES "unusedFunction")
+    message(FATAL_ERROR "Unexpected nodes reachable from the roots:\n${output}")
+endif()
+
+run_checked("${GRAPH}" "${graph}" degree helper)
+if(NOT output MATCHES "in: 1,")
+    message(FATAL_ERROR "Unexpected degree of helper:\n${output}")
+endif()
+
+# A truncated file must be rejected rather than read out of bounds
+if(UNIX)
+    file(READ "${graph}" graph_hex HEX)
+    string(LENGTH "${graph_hex}" graph_hex_length)
+    math(EXPR truncated_size "${graph_hex_length} / 4")
+    execute_process(COMMAND head -c ${truncated_size} "${graph}"
+        OUTPUT_FILE "${work_dir}/truncated.bin")
+    execute_process(COMMAND "${GRAPH}" "${work_dir}/truncated.bin" summary
+        RESULT_VARIABLE result OUTPUT_QUIET ERROR_QUIET)
+    if(NOT result EQUAL 1)
+        message(FATAL_ERROR "caide-graph accepted a truncated graph (${result})")
+    endif()
+endif()
+
+# The graph can't be written
+execute_process(COMMAND "${CMD}" -- -d "${work_dir}" -o "${work_dir}/result.cpp"
+    -g "${work_dir}/missing/graph.bin" "${work_dir}/main.cpp"
+    RESULT_VARIABLE result OUTPUT_QUIET ERROR_QUIET)
+if(result EQUAL 0)
+    message(FATAL_ERROR "cmd succeeded although the graph couldn't be written")
+endif()
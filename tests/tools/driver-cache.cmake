@@ -0,0 +1,77 @@
+# Checks that `cmd --driver-cache` stores the results of the clang driver in the given file,
+# that a run using the stored results produces the same output and reports the same driver
+# warnings, that a damaged cache file is ignored, and that a failure to write the file
+# is an error.
+#
+# Usage: cmake -DCMD=<cmd> -DTEMP_DIR=<dir> -P driver-cache.cmake
+
+set(work_dir "${TEMP_DIR}/driver-cache")
+file(REMOVE_RECURSE "${work_dir}")
+file(MAKE_DIRECTORY "${work_dir}")
+
+file(WRITE "${work_dir}/main.cpp" "#include <cstdio>
+int unused() { return 0; }
+int main() { std::printf(\"%d\\n\", 1); }
+")
+
+function(run_checked)
+    execute_process(COMMAND ${ARGN} RESULT_VARIABLE result OUTPUT_QUIET ERROR_VARIABLE errors)
+    if(NOT result EQUAL 0)
+        message(FATAL_ERROR "Failed (${result}): ${ARGN}\n${errors}")
+    endif()
+endfunction()
+
+# Reference output
+run_checked("${CMD}" -std=c++11 -- -d "${work_dir}" -o "${work_dir}/expected.cpp"
+    "${work_dir}/main.cpp")
+file(READ "${work_dir}/expected.cpp" expected)
+
+set(cache "${work_dir}/driver.cache")
+foreach(run first second)
+    run_checked("${CMD}" -std=c++11 -- -d "${work_dir}" -o "${work_dir}/${run}.cpp"
+        --driver-cache "${cache}" "${work_dir}/main.cpp")
+    file(READ "${work_dir}/${run}.cpp" output)
+    if(NOT output STREQUAL expected)
+        message(FATAL_ERROR "Output of the ${run} run with the driver cache differs:\n${output}")
+    endif()
+endforeach()
+
+if(NOT EXISTS "${cache}")
+    message(FATAL_ERROR "The driver cache was not written")
+endif()
+file(STRINGS "${cache}" cache_lines)
+list(GET cache_lines 0 signature)
+if(NOT signature STREQUAL "caide-driver-cache 2" OR NOT cache_lines MATCHES "entry [1-9]")
+    message(FATAL_ERROR "Unexpected contents of the driver cache:\n${cache_lines}")
+endif()
+
+# A damaged cache is not used
+file(WRITE "${cache}" "caide-driver-cache 2\nentry 5 7 0\n-std=c++11\n")
+run_checked("${CMD}" -std=c++11 -- -d "${work_dir}" -o "${work_dir}/damaged.cpp"
+    --driver-cache "${cache}" "${work_dir}/main.cpp")
+file(READ "${work_dir}/damaged.cpp" output)
+if(NOT output STREQUAL expected)
+    message(FATAL_ERROR "Output with a damaged driver cache differs:\n${output}")
+endif()
+
+# Warnings of the driver are reported when the stored results are used
+set(warning_cache "${work_dir}/warning.cache")
+foreach(run first second)
+    execute_process(COMMAND "${CMD}" -std=c++11 "-L${work_dir}" -- -d "${work_dir}"
+        -o "${work_dir}/${run}.cpp" --driver-cache "${warning_cache}" "${work_dir}/main.cpp"
+        RESULT_VARIABLE result OUTPUT_QUIET ERROR_VARIABLE errors)
+    if(NOT result EQUAL 0)
+        message(FATAL_ERROR "Failed (${result}):\n${errors}")
+    endif()
+    if(NOT errors MATCHES "argument unused during compilation")
+        message(FATAL_ERROR "The driver warning was not reported in the ${run} run:\n${errors}")
+    endif()
+endforeach()
+
+# The cache file can't be written
+execute_process(COMMAND "${CMD}" -std=c++11 -- -d "${work_dir}" -o "${work_dir}/unwritable.cpp"
+    --driver-cache "${work_dir}/missing/driver.cache" "${work_dir}/main.cpp"
+    RESULT_VARIABLE result OUTPUT_QUIET ERROR_VARIABLE errors)
+if(result EQUAL 0 OR NOT errors MATCHES "Couldn't write the driver cache")
+    message(FATAL_ERROR "A failure to write the driver cache was not reported (${result}):\n${errors}")
+endif()
@@ -0,0 +1,131 @@
+# Checks that `cmd --cache` reuses the result of the inline stage while the program and
+# its headers are unchanged, together with the warnings of the stage, and runs the stage
+# again when a C++ file changes. A header whose body changes while its preprocessor directives
+# stay the same is patched into the cached result; a changed directive invalidates the entry,
+# and so do a header created earlier in the include path and a changed include path variable.
+#
+# Usage: cmake -DCMD=<cmd> -DTEMP_DIR=<dir> -P inline-cache.cmake
+
+set(work_dir "${TEMP_DIR}/inline-cache")
+file(REMOVE_RECURSE "${work_dir}")
+file(MAKE_DIRECTORY "${work_dir}")
+
+file(WRITE "${work_dir}/lib.h" "#ifndef LIB_H
+#define LIB_H
+inline int f(int x) { if (x) return 1; }
+#endif
+")
+file(WRITE "${work_dir}/main.cpp" "#include \"lib.h\"
+int main() { return f(1); }
+")
+
+# Sets `inline_stage` to the statistics line of the inline stage, `warnings` to the number
+# of -Wreturn-type warnings and `output` to the result. Arguments are clang options.
+function(run_cached)
+    execute_process(COMMAND "${CMD}" ${ARGN} -- -d "${work_dir}" -o "${work_dir}/result.cpp" --cache
+        --stats "${work_dir}/main.cpp"
+        RESULT_VARIABLE result OUTPUT_QUIET ERROR_VARIABLE errors)
+    if(NOT result EQUAL 0)
+        message(FATAL_ERROR "Failed (${result}):\n${errors}")
+    endif()
+    string(REGEX MATCH "inline: [^\n]*" stage "${errors}")
+    string(REGEX MATCHALL "control may reach end of non-void function" matches "${errors}")
+    list(LENGTH matches count)
+    file(READ "${work_dir}/result.cpp" result_code)
+    set(inline_stage "${stage}" PARENT_SCOPE)
+    set(warnings ${count} PARENT_SCOPE)
+    set(output "${result_code}" PARENT_SCOPE)
+endfunction()
+
+run_cached()
+if(NOT inline_stage MATCHES "^inline: [0-9]+ us$")
+    message(FATAL_ERROR "The inline stage was not run: ${inline_stage}")
+endif()
+if(warnings EQUAL 0)
+    message(FATAL_ERROR "No warning reported")
+endif()
+set(first_output "${output}")
+set(first_warnings ${warnings})
+
+run_cached()
+if(NOT inline_stage MATCHES "^inline: cached")
+    message(FATAL_ERROR "The cached result was not used: ${inline_stage}")
+endif()
+if(NOT output STREQUAL first_output)
+    message(FATAL_ERROR "Cached result differs:\n${output}\nExpected:\n${first_output}")
+endif()
+if(NOT warnings EQUAL first_warnings)
+    message(FATAL_ERROR "${warnings} warnings instead of ${first_warnings} with the cached result")
+endif()
+
+file(GLOB temporary_files "${work_dir}/*.tmp")
+if(temporary_files)
+    message(FATAL_ERROR "Temporary files are left: ${temporary_files}")
+endif()
+
+# A changed C++ file invalidates the entry
+file(APPEND "${work_dir}/main.cpp" "int g() { return 2; }\n")
+run_cached()
+if(NOT inline_stage MATCHES "^inline: [0-9]+ us$")
+    message(FATAL_ERROR "The cached result was used for a changed file: ${inline_stage}")
+endif()
+
+# Only the body of the header changes: the cached result is patched
+file(WRITE "${work_dir}/lib.h" "#ifndef LIB_H
+#define LIB_H
+inline int f(int x) { if (x) return 3; }
+#endif
+")
+run_cached()
+if(NOT inline_stage MATCHES "^inline: cached")
+    message(FATAL_ERROR "The cached result was not patched: ${inline_stage}")
+endif()
+if(NOT output MATCHES "return 3;" OR output MATCHES "return 1;")
+    message(FATAL_ERROR "The cached result was not patched with the new header:\n${output}")
+endif()
+set(patched_output "${output}")
+
+file(REMOVE "${work_dir}/inline-cache.manifest" "${work_dir}/inline-cache.cpp")
+run_cached()
+if(NOT output STREQUAL patched_output)
+    message(FATAL_ERROR "Patched result differs:\n${patched_output}\nExpected:\n${output}")
+endif()
+
+# A directive of the header changes: the entry is invalidated
+file(WRITE "${work_dir}/lib.h" "#ifndef LIB_H
+#define LIB_H
+#define LIB_VERSION 2
+inline int f(int x) { if (x) return 3; }
+#endif
+")
+run_cached()
+if(NOT inline_stage MATCHES "^inline: [0-9]+ us$")
+    message(FATAL_ERROR "The cached result was used after a directive changed: ${inline_stage}")
+endif()
+
+# A header is created in a directory searched before the one the cached header was found in
+file(MAKE_DIRECTORY "${work_dir}/first" "${work_dir}/second")
+file(RENAME "${work_dir}/lib.h" "${work_dir}/second/lib.h")
+set(include_options "-I${work_dir}/first" "-I${work_dir}/second")
+run_cached(${include_options})
+run_cached(${include_options})
+if(NOT inline_stage MATCHES "^inline: cached")
+    message(FATAL_ERROR "The cached result was not used: ${inline_stage}")
+endif()
+file(WRITE "${work_dir}/first/lib.h" "inline int f(int) { return 4; }
+")
+run_cached(${include_options})
+if(NOT inline_stage MATCHES "^inline: [0-9]+ us$")
+    message(FATAL_ERROR "The cached result was used after a header was shadowed: ${inline_stage}")
+endif()
+if(NOT output MATCHES "return 4;")
+    message(FATAL_ERROR "The shadowing header was not inlined:\n${output}")
+endif()
+
+# An include path variable changes
+set(ENV{CPLUS_INCLUDE_PATH} "${work_dir}/second")
+run_cached(${include_options})
+unset(ENV{CPLUS_INCLUDE_PATH})
+if(NOT inline_stage MATCHES "^inline: [0-9]+ us$")
+    message(FATAL_ERROR "The cached result was used after CPLUS_INCLUDE_PATH changed: ${inline_stage}")
+endif()
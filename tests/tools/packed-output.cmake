@@ -0,0 +1,90 @@
+# Checks that outputs appended to a packed output container by cmd are extracted
+# unchanged by caide-unpack, and that cmd fails if the container can't be written.
+#
+# Usage: cmake -DCMD=<cmd> -DUNPACK=<caide-unpack> -DTEMP_DIR=<dir> -P packed-output.cmake
+
+set(work_dir "${TEMP_DIR}/packed-output")
+file(REMOVE_RECURSE "${work_dir}")
+file(MAKE_DIRECTORY "${work_dir}")
+
+file(WRITE "${work_dir}/main.cpp" "int unused() { return 0; }\nint main() { return 0; }\n")
+file(WRITE "${work_dir}/broken.cpp" "int main() { return undeclared; }\n")
+
+function(run_checked)
+    execute_process(COMMAND ${ARGN} RESULT_VARIABLE result OUTPUT_VARIABLE output)
+    if(NOT result EQUAL 0)
+        message(FATAL_ERROR "Failed (${result}): ${ARGN}")
+    endif()
+    set(output "${output}" PARENT_SCOPE)
+endfunction()
+
+# Reference output
+run_checked("${CMD}" -- -d "${work_dir}" -o "${work_dir}/expected.cpp" "${work_dir}/main.cpp")
+file(READ "${work_dir}/expected.cpp" expected)
+
+# Two successful jobs and a failed one in the same container
+set(container "${work_dir}/results")
+run_checked("${CMD}" -- -d "${work_dir}" -p "${container}" -j 1 "${work_dir}/main.cpp")
+run_checked("${CMD}" -- -d "${work_dir}" -p "${container}" -j 2 "${work_dir}/main.cpp")
+execute_process(COMMAND "${CMD}" -- -d "${work_dir}" -p "${container}" -j 3 "${work_dir}/broken.cpp"
+    RESULT_VARIABLE result OUTPUT_QUIET ERROR_QUIET)
+if(result EQUAL 0)
+    message(FATAL_ERROR "cmd succeeded on a program that doesn't compile")
+endif()
+
+run_checked("${UNPACK}" "${container}" list)
+string(REGEX MATCHALL "\n[0-9]+\t" jobs "${output}")
+list(LENGTH jobs num_jobs)
+if(NOT num_jobs EQUAL 3)
+    message(FATAL_ERROR "Expected 3 entries in the container:\n${output}")
+endif()
+
+foreach(job 1 2)
+    run_checked("${UNPACK}" "${container}" get ${job})
+    if(NOT output STREQUAL expected)
+        message(FATAL_ERROR "Output of job ${job} differs:\n${output}\nExpected:\n${expected}")
+    endif()
+endforeach()
+
+execute_process(COMMAND "${UNPACK}" "${container}" get 3 RESULT_VARIABLE result OUTPUT_QUIET)
+if(NOT result EQUAL 2)
+    message(FATAL_ERROR "Job 3 should be stored as failed, caide-unpack returned ${result}")
+endif()
+
+# The container can't be created
+execute_process(COMMAND "${CMD}" -- -d "${work_dir}" -p "${work_dir}/missing/results" -j 4
+    "${work_dir}/main.cpp" RESULT_VARIABLE result OUTPUT_QUIET ERROR_QUIET)
+if(result EQUAL 0)
+    message(FATAL_ERROR "cmd succeeded although the container can't be written")
+endif()
+
+# Writing the outputs fails
+if(UNIX AND EXISTS /dev/full)
+    execute_process(COMMAND ln -s /dev/full "${work_dir}/full.data")
+    execute_process(COMMAND "${CMD}" -- -d "${work_dir}" -p "${work_dir}/full" -j 5
+        "${work_dir}/main.cpp" RESULT_VARIABLE result OUTPUT_QUIET ERROR_QUIET)
+    if(result EQUAL 0)
+        message(FATAL_ERROR "cmd succeeded although the outputs couldn't be written")
+    endif()
+endif()
+
+# A damaged record in the middle of the index is rejected rather than read out of bounds:
+# cut the data file inside job 1, so that the records of jobs 2 and 3 point past its end,
+# and append another job after them
+if(UNIX)
+    string(LENGTH "${expected}" job1_length)
+    math(EXPR truncated_size "${job1_length} - 1")
+    execute_process(COMMAND head -c ${truncated_size} "${container}.data"
+        OUTPUT_FILE "${work_dir}/truncated.data")
+    file(RENAME "${work_dir}/truncated.data" "${container}.data")
+    run_checked("${CMD}" -- -d "${work_dir}" -p "${container}" -j 6 "${work_dir}/main.cpp")
+    execute_process(COMMAND "${UNPACK}" "${container}" get 2
+        RESULT_VARIABLE result OUTPUT_QUIET ERROR_QUIET)
+    if(NOT result EQUAL 1)
+        message(FATAL_ERROR "caide-unpack accepted a damaged record (${result})")
+    endif()
+    run_checked("${UNPACK}" "${container}" get 6)
+    if(NOT output STREQUAL expected)
+        message(FATAL_ERROR "Output of job 6 differs:\n${output}\nExpected:\n${expected}")
+    endif()
+endif()